@@ -6,35 +6,142 @@
  * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
  * don't forget what free software means, even if today is so diffused.
  *
- * Simple text based progress bar
+ * Text based progress reporter: percentage, smoothed rate and ETA of
+ * the file and of the batch (getall), redrawn at most every
+ * PROGRESS_DRAW_USEC on a terminal, a log line every PROGRESS_LOG_USEC
+ * otherwise.
  *
  * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
  * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
  */
 
 #include <stdio.h>
-#include "bar.h"
+#include <unistd.h>
+#include "s10sh.h"
+
+int progress_quiet = 0;	/* no reports, for linkbench */
+
+static int is_tty = -1;
+static unsigned long long file_start, last_draw, last_sample, last_done;
+static double rate;		/* bytes/s, moving average */
+
+/* the batch, see progress_batch_begin() */
+static int batch_depth = 0;
+static int batch_files, batch_files_done;
+static unsigned long long batch_bytes, batch_bytes_done, batch_start;
+
+static char *eta(double seconds, char *buf)
+{
+	unsigned long s;
+
+	if (seconds < 0 || seconds > 359999) {
+		sprintf(buf, "--:--");
+		return buf;
+	}
+	s = (unsigned long)(seconds + 0.5);
+	if (s >= 3600)
+		sprintf(buf, "%lu:%02lu:%02lu", s/3600, (s/60)%60, s%60);
+	else
+		sprintf(buf, "%lu:%02lu", s/60, s%60);
+	return buf;
+}
+
+/* The batch rate is bytes over wall time, it includes the per file
+ * commands the file rate doesn't see. */
+static void report(int total, int done, unsigned long long now)
+{
+	char line[128], b1[16], b2[16];
+	double brate, left;
+	int len;
+
+	len = snprintf(line, sizeof(line), "%3d%% %d/%d %.2f MB/s eta %s",
+		total ? (int)((double)done*100/total) : 100, done, total,
+		rate/1048576, eta(rate > 0 ? (total-done)/rate : -1, b1));
+	if (batch_depth && batch_bytes) {
+		unsigned long long bdone = batch_bytes_done + done;
+
+		brate = now > batch_start ?
+			bdone * 1e6 / (now - batch_start) : 0;
+		left = brate > 0 ? (batch_bytes - bdone) / brate : -1;
+		len += snprintf(line+len, sizeof(line)-len,
+			" | %d/%d %d%% eta %s",
+			batch_files_done+1, batch_files,
+			(int)((double)bdone*100/batch_bytes), eta(left, b2));
+	}
+	if (is_tty)
+		printf("\r%-78.78s", line);
+	else
+		printf("progress %s\n", line);
+	fflush(stdout);
+}
 
-/* We must assumes 80 columns */
 void progressbar(int op, int total, int done)
 {
-        static int n_written;
-        int i, n_current;
-
-        if (op == PROGRESS_RESET) {
-                n_written = 0;
-                printf("%s", PROGRESS_BAR);
-                return;
-        }
-
-        if (total == 0)
-                return;
-
-        n_current = (int) ((float)done/total*80);
-        if (n_current > n_written) {
-                for (i = 0; i < (n_current-n_written); i++)
-                        putchar(PROGRESS_CHAR);
-        }
-        fflush(stdout);
-        n_written = n_current;
+	unsigned long long now;
+	double dt, alpha;
+
+	if (progress_quiet)
+		return;
+	if (is_tty == -1)
+		is_tty = isatty(1);
+	now = get_mono_usec();
+
+	if (op == PROGRESS_RESET) {
+		file_start = last_draw = last_sample = now;
+		last_done = 0;
+		/* inside a batch the rate goes on from file to file */
+		if (!batch_depth)
+			rate = 0;
+		return;
+	}
+
+	if (total == 0)
+		return;
+
+	/* sample the rate and redraw when due, and at the end */
+	dt = (now - last_sample) / 1e6;
+	if (dt >= PROGRESS_DRAW_USEC / 1e6) {
+		alpha = dt / (PROGRESS_TAU + dt);
+		if (rate == 0)
+			rate = (done - last_done) / dt;
+		else
+			rate += alpha * ((done - last_done) / dt - rate);
+		last_sample = now;
+		last_done = done;
+	}
+	if (done >= total) {
+		if (rate == 0 && now > file_start)
+			rate = done * 1e6 / (now - file_start);
+		report(total, done, now);
+		if (batch_depth) {
+			batch_files_done++;
+			batch_bytes_done += total;
+		}
+		return;
+	}
+	if (now - last_draw >= (is_tty ? PROGRESS_DRAW_USEC :
+	    PROGRESS_LOG_USEC)) {
+		report(total, done, now);
+		last_draw = now;
+	}
+}
+
+/* A batch of files with the sizes from the listing; nested batches
+ * (getall inside -g) are part of the outer one. */
+void progress_batch_begin(int files, unsigned long long bytes)
+{
+	if (batch_depth++)
+		return;
+	batch_files = files;
+	batch_bytes = bytes;
+	batch_files_done = 0;
+	batch_bytes_done = 0;
+	batch_start = get_mono_usec();
+	rate = 0;
+}
+
+void progress_batch_end(void)
+{
+	if (batch_depth > 0)
+		batch_depth--;
 }
@@ -15,10 +15,16 @@
 
 #define COMMANDARGS_MAX 32
 
-#define PROGRESS_BAR	"0------------------25------------------50" \
-			"------------------75----------------100\n"
-#define PROGRESS_CHAR   '.'
 #define PROGRESS_RESET  0
 #define PROGRESS_PRINT  1
 
+#define PROGRESS_DRAW_USEC	100000	/* 10 redraws a second at most */
+#define PROGRESS_LOG_USEC	5000000	/* a line every 5 s if not a tty */
+#define PROGRESS_TAU		2.0	/* seconds, rate moving average */
+
+extern int progress_quiet;
+
+void progress_batch_begin(int files, unsigned long long bytes);
+void progress_batch_end(void);
+
 #endif
@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# s10sh transfer benchmark: scripted workloads against the virtual
+# camera (-V), one line per workload in a tab separated file.
+#
+# usage: ./bench.sh [output]      (default bench.tsv)
+#
+# Columns: workload, files, bytes, seconds, MB/s, files/s, p50 and p99
+# per file latency in ms, peak RSS in kB. The times come from the
+# transfer log of s10sh (-X), the seconds are the whole session.
+
+S10SH=${S10SH:-./s10sh}
+OUT=${1:-bench.tsv}
+
+case $S10SH in
+/*) ;;
+*) S10SH=`pwd`/$S10SH ;;
+esac
+
+if ! "$S10SH" -V files=1 -l > /dev/null 2>&1; then
+	echo "$S10SH can't run the virtual camera, build it with USB support"
+	exit 1
+fi
+
+WORK=`mktemp -d /tmp/s10bench.XXXXXX` || exit 1
+trap 'rm -rf "$WORK"' 0 1 2 15
+
+# run <name> <spec> [options], the s10sh commands come from stdin
+run() {
+	name=$1
+	spec=$2
+	shift 2
+	rm -rf "$WORK/dl"
+	mkdir "$WORK/dl"
+	(cd "$WORK/dl" && "$S10SH" -V "$spec" -X "$WORK/$name.log" "$@") \
+		> "$WORK/$name.out" 2>&1
+	if ! grep '^# session' "$WORK/$name.log" > /dev/null 2>&1; then
+		echo "$name: FAILED, output follows"
+		tail -20 "$WORK/$name.out"
+		return
+	fi
+	session=`awk -F'\t' '/^# session/ { print $2 }' "$WORK/$name.log"`
+	rss=`awk -F'\t' '/^# session/ { print $4 }' "$WORK/$name.log"`
+	bytes=`awk -F'\t' '!/^#/ { b += $3 } END { printf "%.0f", b }' \
+		"$WORK/$name.log"`
+	grep -v '^#' "$WORK/$name.log" | cut -f4 | sort -n | \
+	awk -v name="$name" -v session="$session" -v rss="$rss" \
+	    -v bytes="$bytes" '
+		{ v[NR] = $1 }
+		END {
+			n = NR
+			secs = session / 1000000
+			if (secs <= 0) secs = 0.000001
+			p50 = n ? v[int((n * 50 + 99) / 100)] : 0
+			p99 = n ? v[int((n * 99 + 99) / 100)] : 0
+			printf "%s\t%d\t%s\t%.3f\t%.2f\t%.1f\t%.3f\t%.3f\t%d\n",
+				name, n, bytes, secs, bytes / 1048576 / secs,
+				n / secs, p50 / 1000, p99 / 1000, rss
+		}' >> "$OUT"
+	tail -1 "$OUT"
+}
+
+printf "workload\tfiles\tbytes\tseconds\tMB/s\tfiles/s\tp50_ms\tp99_ms\tmaxrss_kb\n" > "$OUT"
+cat "$OUT"
+
+printf 'cd DCIM\ncd 100CANON\nget IMG_0001.JPG\nquit\n' | \
+	run large folders=1,files=1,size=64M
+
+printf 'cd DCIM\ncd 100CANON\ngetall\nquit\n' | \
+	run small folders=1,files=2000,size=16k
+
+run getall folders=8,files=100,size=1M,crw=10 -g < /dev/null
+
+run getallnew folders=8,files=200,size=512k,new=10 -n < /dev/null
+
+printf 'cd DCIM\ncd 100CANON\ndeleteall\nquit\n' | \
+	run delete folders=1,files=2000,size=1M
+
+head -c 4194304 /dev/urandom > "$WORK/upload.jpg"
+{
+	i=0
+	while [ $i -lt 16 ]; do
+		echo "put $WORK/upload.jpg IMG_9$i.JPG"
+		i=`expr $i + 1`
+	done
+	echo quit
+} | run upload folders=1,files=1
+
+echo "results in $OUT"
@@ -27,6 +27,7 @@
 #include <signal.h>
 #include <ctype.h>
 #include <err.h>
+#include <sys/resource.h>
 #include "s10sh.h"
 
 char        camera_name[0x21] = "Unknown camera model";
@@ -111,12 +112,61 @@ void dump_hex(const char *msg, const unsigned char *buf, int len)
     printf("\n");
 }                               /* end dump */
 
-unsigned long get_usec(void)
+/* microseconds from an arbitrary point, never goes backward */
+unsigned long long get_mono_usec(void)
 {
-        struct timeval tmptv;
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
 
-        gettimeofday(&tmptv, NULL);
-        return tmptv.tv_usec;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (unsigned long long)ts.tv_sec*1000000+ts.tv_nsec/1000;
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return (unsigned long long)tv.tv_sec*1000000+tv.tv_usec;
+	}
+}
+
+/* Per file transfer log (-X): one line per get, delete and put with
+ * the bytes and the microseconds it took, and a last line with the
+ * session time and the peak RSS, for bench.sh and the like. */
+static FILE *xferlog_fp = NULL;
+static unsigned long long xferlog_start;
+
+int xferlog_open(char *filename)
+{
+	xferlog_fp = fopen(filename, "w");
+	if (!xferlog_fp) {
+		perror("xferlog: fopen");
+		return -1;
+	}
+	fprintf(xferlog_fp, "# op\tname\tbytes\tusec\n");
+	xferlog_start = get_mono_usec();
+	return 0;
+}
+
+void xferlog(char *op, char *name, unsigned long long bytes,
+	unsigned long long usec)
+{
+	if (!xferlog_fp)
+		return;
+	fprintf(xferlog_fp, "%s\t%s\t%llu\t%llu\n", op, name, bytes, usec);
+}
+
+void xferlog_close(void)
+{
+	struct rusage ru;
+
+	if (!xferlog_fp)
+		return;
+	memset(&ru, 0, sizeof(ru));
+	getrusage(RUSAGE_SELF, &ru);
+	fprintf(xferlog_fp, "# session\t%llu\tmaxrss_kb\t%ld\n",
+		get_mono_usec() - xferlog_start, ru.ru_maxrss);
+	fclose(xferlog_fp);
+	xferlog_fp = NULL;
 }
 
 int camera_last_ls(void)
@@ -139,31 +189,53 @@ int camera_last_ls(void)
 	return 0;
 }
 
+/* is the file j of the last ls one of the 'which' files? */
+int last_ls_selected(int j, int which)
+{
+	if (which == WHICH_NEW)
+		return (dirlist[j]->type & ATTR_NEW) != 0;
+	else if (which == WHICH_OLD)
+		return (dirlist[j]->type & ATTR_NEW) == 0;
+	return 1;
+}
+
+/* files and bytes camera_get_last_ls(which) would get */
+int camera_last_ls_size(int which, unsigned long long *bytes)
+{
+	int j, files = 0;
+
+	for (j = 0; j < dirlist_size; j++) {
+		if (!last_ls_selected(j, which))
+			continue;
+		files++;
+		*bytes += dirlist[j]->size;
+	}
+	return files;
+}
+
 int camera_get_last_ls(int which)
 {
-	int j;
+	unsigned long long bytes = 0;
+	int j, files;
 
 	if (dirlist_size == 0) {
 		printf("last ls is empty\n");
 		return -1;
 	}
 
+	files = camera_last_ls_size(which, &bytes);
+	progress_batch_begin(files, bytes);
 	for (j = 0; j < dirlist_size; j++) {
 		char aux[1024];
 
-		if (which == WHICH_NEW) {
-			if (!(dirlist[j]->type & ATTR_NEW))
-				continue;
-		}
-		else if (which == WHICH_OLD) {
-			if (dirlist[j]->type & ATTR_NEW)
-				continue;
-		}
+		if (!last_ls_selected(j, which))
+			continue;
 
 		snprintf(aux, 1024, "%s\\%s", lastpath, dirlist[j]->name);
 		camera_get_image(aux, NULL);
 		printf("\n");
 	}
+	progress_batch_end();
         if (opt_debug) {
           printf("getlastls successful\n");
         }
@@ -216,6 +288,38 @@ int offset_from_GMT (void) {
   return ((int)diff);
 }
 
+void dirlist_clear(void)
+{
+	int j;
+
+	for (j = 0; j < dirlist_size; j++)
+		free(dirlist[j]);
+	dirlist_size = 0;
+}
+
+/* a copy of entry at the end of the ls cache */
+void dirlist_add(struct canonfile *entry)
+{
+	if (dirlist_size == dirlist_alloc) {
+		struct canonfile **newlist;
+
+		newlist = realloc(dirlist, sizeof(struct canonfile *)*
+			(dirlist_alloc ? dirlist_alloc*2 : 1024));
+		if (!newlist) {
+			perror("realloc");
+			exit(1);
+		}
+		dirlist = newlist;
+		dirlist_alloc = dirlist_alloc ? dirlist_alloc*2 : 1024;
+	}
+	dirlist[dirlist_size] = malloc(sizeof(struct canonfile));
+	if (!dirlist[dirlist_size]) {
+		perror("malloc");
+		exit(1);
+	}
+	*dirlist[dirlist_size++] = *entry;
+}
+
 int camera_get_list(char *pathname)
 {
 	unsigned char *message = NULL;
@@ -224,9 +328,11 @@ int camera_get_list(char *pathname)
 	unsigned char aux[1024];
 	char arg[1024];
 	unsigned char *pkt;
-	int j, totbytes = 0, first_packet = 1;
+	int first_packet = 1;
+	unsigned long long totbytes = 0;
 	struct header hdr;
-	unsigned char *p;
+	unsigned char *p, *end;
+	struct canonfile entry;
 
 	if (pathname == NULL)
 		pathname = lastpath;
@@ -261,6 +367,10 @@ int camera_get_list(char *pathname)
 			unsigned char *newmem;
 
 			pkt = serial_get_packet(&hdr); /* data */
+			if (pkt == NULL) {
+				if (message) free(message);
+				return -1;
+			}
 			if (hdr.type == PKT_TYPE_EOT)
 				break;
 
@@ -289,21 +399,23 @@ int camera_get_list(char *pathname)
 
 #ifdef HAVE_USB_SUPPORT
 	case USB_MODE:
+	case VIRTUAL_MODE:
 		aux[0] = DL_NO_RECURSION;
 		memcpy(aux+1, pathname, strlen(pathname));
 		memset(aux+1+strlen(pathname), 0, 3);
 		USB_cmd(0x0b, 0x11, 0x202, 0x01, aux, strlen(pathname)+4);
-		USB_read(aux, 0x40);
-		j = byteswap32(*(unsigned int*)(aux+6));
-		if (j == 0)
+		if (USB_read(aux, 0x40) < 0)
+			return -1;
+		message_size = byteswap32(*(unsigned int*)(aux+6));
+		if (message_size == 0)
 			return -1;
-		message = malloc(j);
+		message = malloc(message_size);
 		if (!message) {
 			perror("malloc");
 			exit(1);
 		}
-		USB_read(message, j);
-		if (message[0] != 0x80) {
+		if (USB_read(message, message_size) < 0 ||
+		    message[0] != 0x80) {
 			free(message);
 			return -1;
 		}
@@ -318,29 +430,20 @@ int camera_get_list(char *pathname)
 		p += 10;
 
 	/* skip the directory name */
+	end = message + message_size;
 	strncpy(lastpath, p, 1024);
 	p += strlen(p) + 1;
 
 	/* free the old directory list cache */
-	for (j = 0; j < dirlist_size; j++)
-		free(dirlist[j]);
-	dirlist_size = 0;
+	dirlist_clear();
 
 	if (mydisplay == 1 )
 		printf("\n");
-	while(1) {
-		if (!*(p+10)) break;
-		dirlist[dirlist_size] = malloc(sizeof(struct canonfile));
-		dirlist[dirlist_size]->type = *p;
-		p += 2;
-		memcpy(&dirlist[dirlist_size]->size, p, 4);
-		dirlist[dirlist_size]->size = byteswap32(dirlist[dirlist_size]->size);
-		/* sigbus on solaris + sun cc */
-		/* dirlist[dirlist_size]->size = byteswap32(*(unsigned int*)p); */
-		totbytes += dirlist[dirlist_size]->size;
-		p += 4;
-		memcpy(&dirlist[dirlist_size]->date, p, 4);
-		dirlist[dirlist_size]->date = byteswap32(dirlist[dirlist_size]->date);
+	while(p < end) {
+		if (parse_list_entry(&p, end, &entry) != 1)
+			break;
+		dirlist_add(&entry);
+		totbytes += entry.size;
 
 		/* "adjust" the date field so that things are printed according
 		 * to one's timezone info. The 4-byte date field retreived from
@@ -349,21 +452,12 @@ int camera_get_list(char *pathname)
 		 * make its own adjustments for the time zone and the wrong time/
 		 * date is printed out (off by N hours).
 		 */
-		dirlist[dirlist_size]->date += GMT_offset;
-		
-		/* sigbus on solaris + sun cc */
-		/* dirlist[dirlist_size]->date = byteswap32(*(unsigned int*)p); */
-		p += 4;
-		strncpy(dirlist[dirlist_size]->name, p, 1024);
-		p += strlen(p);
-
-		dump_filename(dirlist[dirlist_size]);
+		dirlist[dirlist_size-1]->date += GMT_offset;
 
-		p++;
-		dirlist_size++;
+		dump_filename(dirlist[dirlist_size-1]);
 	}
 	if ( mydisplay == 1 )
-		printf("        %d files      %d bytes\n\n", dirlist_size, totbytes);
+		printf("        %d files      %llu bytes\n\n", dirlist_size, totbytes);
 	free(message);
 	return 0;
 }
@@ -399,17 +493,36 @@ time_t get_date_for_image (char *pathname)
   
 }
 
+/* the size in the cached listing, 0 if the file is not there */
+static unsigned int get_size_for_image(char *pathname)
+{
+	char *file = strrchr(pathname, '\\');
+	int j;
+
+	file = file ? file+1 : pathname;
+	for (j = 0; j < dirlist_size; j++)
+		if (!strcmp(dirlist[j]->name, file))
+			return dirlist[j]->size;
+	return 0;
+}
+
 int camera_get_image(char *pathname, char *destfile)
 {
-	time_t timestamp;
-	int fd, len;
-	unsigned char *image = NULL;
+	int fd = -1, len = -1, attempt, attr, reconnects = 0;
+	struct xfer x;
 	char arg[1024];
 	char lowerdestfile[1024];
 	char orig_pathname[1024];
-	char *ptr, *outfile;
+	char outpath[1024];
+	char member[1024];
+	char folder[1024];
+	char named[1024];
+	char tmp[1024];
+	char hex[SHA256_LEN*2+1];
+	char *ptr, *end, *outfile;
 	time_t imagedate;
-	struct timeval tval[2];
+	unsigned int listed;
+	unsigned long long start, usec;
 	
 	strncpy (orig_pathname, pathname, 1024);
 	
@@ -422,79 +535,181 @@ int camera_get_image(char *pathname, char *destfile)
 		destfile = strrchr(pathname, '\\');
 		if (!destfile) return -1;
 		destfile++;
-		/* Create a copy of the destfile name that is all lowercase */
-		strncpy (lowerdestfile, destfile, strlen (destfile)+1);
-		ptr = lowerdestfile;
-		while (*ptr) {
-		  *ptr = tolower(*ptr);
-		  ptr++;
+	}
+	/* Create a copy of the destfile name that is all lowercase */
+	snprintf(lowerdestfile, sizeof(lowerdestfile), "%s", destfile);
+	ptr = lowerdestfile;
+	while (*ptr) {
+	  *ptr = tolower(*ptr);
+	  ptr++;
+	}
+
+	/* Decide which filename to use
+	 */
+	if (use_lowers) {
+	  outfile = lowerdestfile;
+	}
+	else {
+	  outfile = destfile;
+	}
+
+	/* in the first destination directory of the command */
+	if (out_dir) {
+		if (snprintf(outpath, sizeof(outpath), "%s/%s", out_dir,
+		    outfile) >= (int)sizeof(outpath)) {
+			printf("%s/%s: name too long\n", out_dir, outfile);
+			return -1;
 		}
+		outfile = outpath;
+	}
+	/* with -N the name is known at the end, the link fails then */
+	if (out_file && !opt_overwrite && !name_template &&
+	    access(outfile, F_OK) == 0) {
+		printf("===WARNING===> %s: File exists\n", outfile);
+		journal_done(pathname, outfile);
+		return -1;
+	}
+	/* in an archive the file is folder/name */
+	imagedate = get_date_for_image (orig_pathname);
+	listed = get_size_for_image (orig_pathname);
+	end = strrchr(pathname, '\\');
+	for (ptr = end; ptr > pathname && ptr[-1] != '\\' && ptr[-1] != ':';
+	     ptr--)
+		;
+	snprintf(folder, sizeof(folder), "%.*s", (int)(end-ptr), ptr);
+	if (snprintf(member, sizeof(member), "%s%s%s", folder,
+	    folder[0] ? "/" : "", use_lowers ? lowerdestfile : destfile) >=
+	    (int)sizeof(member)) {
+		printf("%s: name too long\n", pathname);
+		return -1;
 	}
 
-	timestamp = time(NULL);
-	if (mode == SERIAL_MODE)
-		image = serial_get_data(pathname, 0x00, &len);
+	/* A transfer that breaks or fails the checks is thrown away and
+	 * the file requested again. Not when the camera has no size for
+	 * it, there is nothing to get. */
+	for (attempt = 0; ; attempt++) {
+		/* -P: the file is there from the start and grows with the
+		 * data, without a name until it is complete */
+		fd = -1;
+		if (out_file && opt_output != OUT_WRITE) {
+			fd = out_open(outfile, tmp);
+			if (fd == -1)
+				return -1;
+		}
+		xfer_init(&x, opt_output, fd);
+		x.fanout = 1;
+		x.hash = (manifest != NULL || opt_free);
+		x.exif = (name_template != NULL);
+		sink_file_begin(use_lowers ? lowerdestfile : destfile, member,
+			imagedate);
+
+		start = get_mono_usec();
+		if (mode == SERIAL_MODE)
+			len = serial_get_xfer(pathname, 0x00, &x);
 #ifdef HAVE_USB_SUPPORT
-	else
-		image = USB_get_data(pathname, 0x00, &len);
+		else
+			len = USB_get_xfer(pathname, 0x00, &x);
 #endif
+		if (len != -1 && xfer_verify(&x, pathname, listed, hex) == 0)
+			break;
 
-	if (!image) {
-		return -1;
-	} else {
-		timestamp = time(NULL) - timestamp;
-		if (!timestamp)
-			timestamp = 1;
-		printf("\nDownloaded in %ld seconds, %ld bytes/s\n",
-                       (long)timestamp, (long) len/timestamp);
-
-		imagedate = get_date_for_image (orig_pathname);
-		
-		/* Decide which filename to use
-		 */
-		if (use_lowers) {
-		  outfile = lowerdestfile;
-		}
-		else {
-		  outfile = destfile;
+		xfer_end(&x, 0);
+		if (fd != -1)
+			out_discard(fd, tmp);
+		sink_file_end(0, 0, NULL);
+		/* -W: the camera came back, the file from the start, only
+		 * a few times for a file that always loses it */
+		if (camera_recover() && ++reconnects <= RECONNECT_RETRIES) {
+			attempt--;
+			continue;
 		}
-		
-		if (opt_overwrite) {
-		  fd = open(outfile, O_RDWR|O_CREAT|O_TRUNC, 0644);
+		if (x.size == 0 || attempt == VERIFY_RETRIES)
+			return -1;
+		metrics_count(MET_REFETCHES, 1);
+		printf("===WARNING===> %s: getting it again\n", pathname);
+	}
+
+	usec = get_mono_usec() - start;
+	printf("\nDownloaded in %.2f seconds, %.0f bytes/s\n",
+		usec / 1e6, len * 1e6 / (usec ? usec : 1));
+
+	/* -N: the final name from the EXIF of the first chunk, in the
+	 * same directory of the temporary file or under it */
+	if (name_template) {
+		if (out_name(named, sizeof(named), name_template,
+		    use_lowers ? lowerdestfile : destfile, folder, &x.info,
+		    imagedate) == -1)
+			snprintf(named, sizeof(named), "%s",
+				use_lowers ? lowerdestfile : destfile);
+		if (!out_dir || named[0] == '/') {
+			snprintf(outpath, sizeof(outpath), "%s", named);
+		} else if (snprintf(outpath, sizeof(outpath), "%s/%s",
+		    out_dir, named) >= (int)sizeof(outpath)) {
+			printf("%s/%s: name too long\n", out_dir, named);
+			outpath[0] = '\0';
 		}
-		else {
-		  fd = open(outfile, O_RDWR|O_CREAT|O_EXCL, 0644);
+		outfile = outpath;
+		if (!outpath[0] || (out_file && out_mkdirs(outfile) == -1)) {
+			xfer_end(&x, 0);
+			if (x.fd != -1)
+				out_discard(x.fd, tmp);
+			sink_file_end(0, 0, NULL);
+			return -1;
 		}
+	}
+	sink_file_end(1, imagedate, name_template ? named : NULL);
 
-		if (fd == -1) {
-			perror("===WARNING===> open");
-			free(image);
+	/* no file, only the sinks */
+	if (!out_file) {
+		xfer_end(&x, 0);
+		goto done;
+	}
+	if (x.fd == -1) {
+		x.fd = out_open(outfile, tmp);
+		if (x.fd == -1) {
+			xfer_end(&x, 0);
 			return -1;
 		}
+	}
+	if (xfer_end(&x, 1) == -1) {
+		out_discard(x.fd, tmp);
+		return -1;
+	}
+	printf("\n");
 
-		write(fd, image, len);
-		close(fd);
-		printf("\n");
-
-		/* If a non-zero result came back from get_date_for_image(),
-		 * then set the atime and mtime values for the file
-		 * using utimes(3).
-		 */
-		if (imagedate) {
-		  tval[0].tv_sec = tval[1].tv_sec = imagedate;
-		  tval[0].tv_usec = tval[1].tv_usec = 0;
-		  utimes (outfile, tval);
-		}
+	/* If a non-zero result came back from get_date_for_image(),
+	 * the file gets it as atime and mtime.
+	 */
+	if (out_publish(x.fd, tmp, outfile, imagedate) == -1)
+		return -1;
 
-		free(image);
+done:
+	journal_done(pathname, outfile);
+	if (x.hash)
+		manifest_add(hex, out_file ? outfile : member);
+	if (out_file)
+		hook_submit(outfile, pathname, len, imagedate,
+			x.hash ? hex : NULL);
+	/* -F: deleted once the copy is durable and read back right */
+	if (opt_free && out_file) {
+		attr = camera_get_file_attr(end+1);
+		if (attr == -1 || (attr & ATTR_PROTECTED))
+			printf("%s: %s, kept on the camera\n", pathname,
+				attr == -1 ? "not in the listing" : "PROTECTED");
+		else
+			hook_verify(outfile, pathname, len, hex);
 	}
+	usec = get_mono_usec() - start;
+	xferlog("get", pathname, len, usec);
+	metrics_file(0, len, usec);
 	camera_file_chmod(pathname, CHMOD_CLEAR, ATTR_NEW);
+	free_run();
 	return 0;
 }
 
 int camera_get_thumb(char *pathname, char *destfile)
 {
-	time_t timestamp;
+	unsigned long long start, wstart, usec;
 	int fd, len;
 	unsigned char *image = NULL;
 	char arg[1024];
@@ -510,7 +725,7 @@ int camera_get_thumb(char *pathname, char *destfile)
 		destfile++;
 	}
 
-	timestamp = time(NULL);
+	start = get_mono_usec();
 	if (mode == SERIAL_MODE)
 		image = serial_get_data(pathname, 0x01, &len);
 #ifdef HAVE_USB_SUPPORT
@@ -521,24 +736,15 @@ int camera_get_thumb(char *pathname, char *destfile)
 	if (!image) {
 		return -1;
 	} else {
-		unsigned char *start;
-		int tlen = 0;
-		unsigned char *t = image;
-
-		/* skip the first FFD8 */
-		t += 2;
-
-		/* search the FFD8 */
-		while(t[0] != 0xFF || t[1] != 0xD8)
-			t++;
-		start = t;
-
-		/* search the FFD9 */
-		while(t[0] != 0xFF || t[1] != 0xD9) {
-			t++;
-			tlen++;
+		unsigned char *thumb;
+		int tlen;
+
+		tlen = parse_thumb(image, len, &thumb);
+		if (tlen == -1) {
+			printf("no thumbnail in the data\n");
+			free(image);
+			return -1;
 		}
-		tlen += 2;
 
 		fd = open(destfile, O_RDWR|O_CREAT|O_TRUNC, 0644);
 		if (fd == -1) {
@@ -546,16 +752,16 @@ int camera_get_thumb(char *pathname, char *destfile)
 			free(image);
 			return -1;
 		}
-		write(fd, start, tlen);
+		wstart = get_mono_usec();
+		write(fd, thumb, tlen);
 		close(fd);
+		metrics_observe(MET_DISK_WRITE, get_mono_usec() - wstart);
 		printf("\n");
-		timestamp = time(NULL) - timestamp;
-		if (!timestamp)
-			timestamp = 1;
-		printf("Downloaded in %ld seconds,"
-			" %ld bytes/s\n",
-                       (long)timestamp, (long)len/timestamp);
+		usec = get_mono_usec() - start;
+		printf("Downloaded in %.2f seconds, %.0f bytes/s\n",
+			usec / 1e6, len * 1e6 / (usec ? usec : 1));
 		free(image);
+		metrics_file(0, len, usec);
 	}
 	return 0;
 }
@@ -644,7 +850,7 @@ int view_all(void)
 		case 'd':
 		case 'D':
 #ifdef HAVE_USB_SUPPORT
-			if (mode == USB_MODE)
+			if (mode != SERIAL_MODE)
 				USB_delete(dirlist[j]->name);
 			else
 #endif
@@ -728,6 +934,7 @@ int camera_file_chmod_all(int action, int bits)
 int camera_delete_all(int which)
 {
 	int j;
+	unsigned long long start;
 
 	if (dirlist_size == 0) {
 		printf("last ls is empty\n");
@@ -754,22 +961,50 @@ int camera_delete_all(int which)
 			continue;
 		}
 
+		start = get_mono_usec();
 #ifdef HAVE_USB_SUPPORT
-		if (mode == USB_MODE)
+		if (mode != SERIAL_MODE)
 			retval = USB_delete(dirlist[j]->name);
 		else
 #endif
 			retval = serial_delete(dirlist[j]->name);
 
-		if (retval == 0)
+		if (retval == 0) {
 			printf("successful\n");
-		else
+			xferlog("delete", aux, 0, get_mono_usec() - start);
+		} else
 			printf("ERROR\n");
 	}
 	printf("delete terminated\n");
 	return 0;
 }
 
+/* A file by its full camera path, -F. The USB command takes the name
+ * in the current folder. */
+int camera_delete_file(char *pathname)
+{
+	char *name;
+	int retval = -1;
+
+	name = strrchr(pathname, '\\');
+	if (name == NULL)
+		return -1;
+	if (mode == SERIAL_MODE)
+		return serial_delete(pathname);
+#ifdef HAVE_USB_SUPPORT
+	{
+		char saved[1024];
+
+		snprintf(saved, sizeof(saved), "%s", lastpath);
+		snprintf(lastpath, sizeof(lastpath), "%.*s",
+			(int)(name-pathname), pathname);
+		retval = USB_delete(name+1);
+		snprintf(lastpath, sizeof(lastpath), "%s", saved);
+	}
+#endif
+	return retval;
+}
+
 int camera_close(void)
 {
 	if (mode == SERIAL_MODE) {
@@ -824,30 +1059,43 @@ void camera_startup_initialization(void)
 {
 	if (mode == SERIAL_MODE) {
 		serial_initial_sync(serialdev);
-		serial_timeout = 5;
 		strncpy(cameraid, serial_get_id(), 1024);
 		strncpy(lastpath, serial_get_disk(), 1024);
 		camera_get_id ();
-	} else if (mode == USB_MODE) {
+	} else if (mode != SERIAL_MODE) {
 #ifdef HAVE_USB_SUPPORT
 		char *aux;
 		USB_initial_sync();
-		aux = camera_get_id();
-		if (aux == NULL) {
-			printf("USB protocol error, retry\n");
-			exit(1);
-		} else
-			strncpy(cameraid, camera_name, 1024);
-		aux = USB_get_disk();
-		if (aux == NULL) {
-			printf("USB protocol error, retry\n");
-			exit(1);
-		} else
-			strncpy(lastpath, aux, 1024);
+		while ((aux = camera_get_id()) == NULL) {
+			if (!camera_recover()) {
+				printf("USB protocol error, retry\n");
+				exit(1);
+			}
+		}
+		strncpy(cameraid, camera_name, 1024);
+		while ((aux = USB_get_disk()) == NULL) {
+			if (!camera_recover()) {
+				printf("USB protocol error, retry\n");
+				exit(1);
+			}
+		}
+		strncpy(lastpath, aux, 1024);
 #endif
 	}
 }
 
+/* -W: the session again, nothing else */
+int camera_reopen(void)
+{
+	if (mode == SERIAL_MODE)
+		return serial_reopen(serialdev);
+#ifdef HAVE_USB_SUPPORT
+	else
+		return USB_reopen();
+#endif
+	return -1; /* avoid warnings */
+}
+
 void camera_ping(void)
 {
 	if (mode == SERIAL_MODE)
@@ -856,6 +1104,139 @@ void camera_ping(void)
 		printf("Not implemented with USB\n");
 }
 
+time_t camera_get_date(void)
+{
+	if (mode == SERIAL_MODE)
+		return serial_get_date();
+#ifdef HAVE_USB_SUPPORT
+	else
+		return USB_get_date();
+#endif
+	return 0; /* avoid warnings */
+}
+
+static int cmp_usec(const void *a, const void *b)
+{
+	unsigned long long x = *(unsigned long long*)a;
+	unsigned long long y = *(unsigned long long*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* sorts the n samples and prints min, median, p99 and max in ms */
+static void linkbench_line(char *what, unsigned long long *v, int n)
+{
+	qsort(v, n, sizeof(*v), cmp_usec);
+	printf("%-16s %4d %10.3f %10.3f %10.3f %10.3f", what, n,
+		v[0]/1000.0, v[n/2]/1000.0, v[(n*99+99)/100-1]/1000.0,
+		v[n-1]/1000.0);
+}
+
+/* Round trip of two cheap commands, then the download of pathname
+ * repeats times for every USB chunk size. Nothing is written and the
+ * file keeps its attributes. */
+void camera_linkbench(char *pathname, int repeats, int *chunks, int nchunks)
+{
+	unsigned long long rtt[LINKBENCH_RTT], t[LINKBENCH_REPEATS_MAX];
+	unsigned long long start;
+	double x[LINKBENCH_CHUNKS_MAX], y[LINKBENCH_CHUNKS_MAX];
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, a, c;
+	unsigned char *image = NULL;
+	char arg[1024], what[32];
+	int j, r, len = 0, good, ac, done = 0;
+#ifdef HAVE_USB_SUPPORT
+	int saved_xfer = usb_xfer_size;
+#endif
+
+	printf("%-16s %4s %10s %10s %10s %10s\n", "ms", "n", "min",
+		"median", "p99", "max");
+	for (j = 0; j < LINKBENCH_RTT; j++) {
+		start = get_mono_usec();
+		camera_get_date();
+		rtt[j] = get_mono_usec() - start;
+	}
+	linkbench_line("date", rtt, LINKBENCH_RTT);
+	printf("\n");
+	for (j = 0; j < LINKBENCH_RTT; j++) {
+		start = get_mono_usec();
+		camera_get_power_status(&good, &ac);
+		rtt[j] = get_mono_usec() - start;
+	}
+	linkbench_line("power", rtt, LINKBENCH_RTT);
+	printf("\n");
+	if (pathname == NULL)
+		return;
+
+	if (strlen(pathname) <= 2 || pathname[1] != ':') {
+		if (snprintf(arg, sizeof(arg), "%s\\%s", lastpath,
+		    pathname) >= (int)sizeof(arg)) {
+			printf("%s: name too long\n", pathname);
+			return;
+		}
+		pathname = arg;
+	}
+	if (mode == SERIAL_MODE) {
+		/* the camera chooses the fragments */
+		chunks[0] = 0;
+		nchunks = 1;
+	}
+	progress_quiet = 1;
+	for (j = 0; j < nchunks; j++) {
+#ifdef HAVE_USB_SUPPORT
+		if (chunks[j])
+			usb_xfer_size = chunks[j];
+#endif
+		for (r = 0; r < repeats; r++) {
+			start = get_mono_usec();
+			if (mode == SERIAL_MODE)
+				image = serial_get_data(pathname, 0x00, &len);
+#ifdef HAVE_USB_SUPPORT
+			else
+				image = USB_get_data(pathname, 0x00, &len);
+#endif
+			t[r] = get_mono_usec() - start;
+			if (!image) {
+				printf("can't get %s\n", pathname);
+				goto out;
+			}
+			free(image);
+		}
+		if (chunks[j])
+			snprintf(what, sizeof(what), "get/%d", chunks[j]);
+		else
+			snprintf(what, sizeof(what), "get");
+		linkbench_line(what, t, repeats);
+		printf("  %.3f MB/s\n", len / 1048576.0 /
+			(t[repeats/2] ? t[repeats/2] : 1) * 1e6);
+		if (chunks[j]) {
+			x[done] = (len + chunks[j] - 1) / chunks[j];
+			y[done] = t[repeats/2];
+			done++;
+		}
+	}
+	/* median time = c + a * transfers: a is the cost of a bulk
+	 * transfer (host, hub, cable), c the rest (camera, wire rate) */
+	for (j = 0; j < done; j++) {
+		sx += x[j];
+		sy += y[j];
+		sxx += x[j]*x[j];
+		sxy += x[j]*y[j];
+	}
+	if (done >= 2 && done*sxx - sx*sx > 0) {
+		a = (done*sxy - sx*sy) / (done*sxx - sx*sx);
+		c = (sy - a*sx) / done;
+		printf("%d bytes: %.3f ms per bulk transfer, %.3f ms for the "
+			"rest (%.3f MB/s without the per transfer cost)\n",
+			len, a/1000, c/1000,
+			c > 0 ? len / 1048576.0 / c * 1e6 : 0.0);
+	}
+out:
+	progress_quiet = 0;
+#ifdef HAVE_USB_SUPPORT
+	usb_xfer_size = saved_xfer;
+#endif
+}
+
 int camera_get_disk_info(char *disk, int *size, int *free)
 {
 	if (mode == SERIAL_MODE)
@@ -12,6 +12,11 @@
 #ifndef S10SH_COMMON_H
 #define S10SH_COMMON_H
 
+/* linkbench */
+#define LINKBENCH_RTT		50	/* samples of every cheap command */
+#define LINKBENCH_REPEATS_MAX	32
+#define LINKBENCH_CHUNKS_MAX	8
+
 typedef enum {
   UNKOWN_CAMERA =   0,
   S10           =   1,       /* S10 found */
@@ -40,9 +45,13 @@ extern char        camera_name[];
 extern camera_type camera_model;
 extern char        camera_owner[];
 
-unsigned long get_usec(void);
+unsigned long long get_mono_usec(void);
 int camera_last_ls(void);
 int camera_get_last_ls(int which);
+int camera_last_ls_size(int which, unsigned long long *bytes);
+int last_ls_selected(int j, int which);
+void dirlist_clear(void);
+void dirlist_add(struct canonfile *entry);
 int camera_get_list(char *pathname);
 void dump_filename(struct canonfile *f);
 int offset_from_GMT(void);
@@ -54,14 +63,22 @@ int camera_get_file_attr(char *name);
 int camera_file_chmod(char *name, int action, int bits);
 int camera_file_chmod_all(int action, int bits);
 int camera_delete_all(int which);
+int camera_delete_file(char *pathname);
 int camera_close(void);
 char *camera_get_id(void);
 char *camera_set_owner(char *name);
 char *camera_get_disk(void);
 void camera_startup_initialization(void);
+int camera_reopen(void);
 void camera_ping(void);
 int camera_get_disk_info(char *disk, int *size, int *free);
 int camera_get_power_status(int *good, int *ac);
+time_t camera_get_date(void);
+void camera_linkbench(char *pathname, int repeats, int *chunks, int nchunks);
 void dump_hex(const char *msg, const unsigned char *buf, int len);
+int xferlog_open(char *filename);
+void xferlog(char *op, char *name, unsigned long long bytes,
+	unsigned long long usec);
+void xferlog_close(void);
 
 #endif
@@ -0,0 +1,137 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * The few EXIF fields of a JPEG the naming template needs, from the
+ * first bytes of the file: the APP1 segment, its TIFF header, IFD0 and
+ * the Exif IFD. Every offset is checked against the bytes there are,
+ * a field out of them is not found.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "exif.h"
+
+#define TAG_MODEL		0x0110
+#define TAG_DATETIME		0x0132
+#define TAG_EXIF_IFD		0x8769
+#define TAG_DATETIME_ORIGINAL	0x9003
+#define TYPE_ASCII		2
+
+struct tiff {
+	unsigned char *p;		/* the TIFF header */
+	unsigned int len;
+	int big;			/* MM, else II */
+};
+
+static unsigned int rd16(struct tiff *t, unsigned int off)
+{
+	unsigned char *p = t->p+off;
+
+	return t->big ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+}
+
+static unsigned int rd32(struct tiff *t, unsigned int off)
+{
+	unsigned char *p = t->p+off;
+
+	if (t->big)
+		return (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	return (unsigned int)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+/* the string of an ASCII entry, NULL if not all of it is there */
+static char *ascii(struct tiff *t, unsigned int entry, char *buf, int size)
+{
+	unsigned int count = rd32(t, entry+4);
+	unsigned int off = count <= 4 ? entry+8 : rd32(t, entry+8);
+
+	if (rd16(t, entry+2) != TYPE_ASCII || count == 0 ||
+	    off > t->len || count > t->len - off)
+		return NULL;
+	if (count > (unsigned int)size)
+		count = size;
+	memcpy(buf, t->p+off, count);
+	buf[count-1] = '\0';
+	return buf;
+}
+
+/* "YYYY:MM:DD HH:MM:SS", the local time of the camera */
+static time_t exif_date(char *s)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(s, "%d:%d:%d %d:%d:%d", &tm.tm_year, &tm.tm_mon,
+	    &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6 ||
+	    tm.tm_year < 1970)
+		return 0;
+	tm.tm_year -= 1900;
+	tm.tm_mon--;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+/* The entries of the IFD at off, the Exif IFD when it is there. */
+static void ifd(struct tiff *t, unsigned int off, struct exif *e,
+	time_t *datetime, int depth)
+{
+	char buf[32];
+	unsigned int n, entry, tag;
+
+	if (off > t->len || t->len - off < 2)
+		return;
+	n = rd16(t, off);
+	for (entry = off+2; n-- && entry+12 <= t->len; entry += 12) {
+		tag = rd16(t, entry);
+		if (tag == TAG_MODEL) {
+			ascii(t, entry, e->model, sizeof(e->model));
+		} else if (tag == TAG_DATETIME) {
+			if (ascii(t, entry, buf, sizeof(buf)))
+				*datetime = exif_date(buf);
+		} else if (tag == TAG_DATETIME_ORIGINAL) {
+			if (ascii(t, entry, buf, sizeof(buf)))
+				e->date = exif_date(buf);
+		} else if (tag == TAG_EXIF_IFD && depth == 0) {
+			ifd(t, rd32(t, entry+8), e, datetime, 1);
+		}
+	}
+}
+
+/* Returns 0 if the date is there, DateTimeOriginal or else DateTime.
+ * Not yet with only the start of the file, call it again with more. */
+int exif_parse(unsigned char *p, unsigned int len, struct exif *e)
+{
+	struct tiff t;
+	time_t datetime = 0;
+	unsigned int off = 2, seg;
+
+	memset(e, 0, sizeof(*e));
+	if (len < 4 || p[0] != 0xFF || p[1] != 0xD8)
+		return -1;
+	/* the segments up to the image data */
+	while(off+4 <= len && p[off] == 0xFF && p[off+1] != 0xDA) {
+		seg = p[off+2] << 8 | p[off+3];
+		if (p[off+1] == 0xE1 && seg >= 16 && off+10 <= len &&
+		    !memcmp(p+off+4, "Exif\0\0", 6)) {
+			t.p = p+off+10;
+			t.len = (seg-8 < len-off-10) ? seg-8 : len-off-10;
+			if (t.len < 8 || (memcmp(t.p, "II*\0", 4) &&
+			    memcmp(t.p, "MM\0*", 4)))
+				return -1;
+			t.big = (t.p[0] == 'M');
+			ifd(&t, rd32(&t, 4), e, &datetime, 0);
+			break;
+		}
+		off += 2+seg;
+	}
+	if (!e->date)
+		e->date = datetime;
+	return e->date ? 0 : -1;
+}
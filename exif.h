@@ -0,0 +1,25 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_EXIF_H
+#define S10SH_EXIF_H
+
+#include <time.h>
+
+#define EXIF_HEAD	8192	/* the fields are looked for up to here */
+
+/* the fields of a JPEG the naming template uses */
+struct exif {
+	time_t date;			/* DateTimeOriginal, 0 if none */
+	char model[64];			/* empty if none */
+};
+
+int exif_parse(unsigned char *p, unsigned int len, struct exif *e);
+
+#endif /* S10SH_EXIF_H */
@@ -0,0 +1,186 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Serial link governor: picks the serial speed at run time using
+ * the CRC errors and timeouts seen in the last window of frames.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "s10sh.h"
+
+int opt_governor = 0;
+
+static struct gov_speed {
+	int speed;
+	unsigned long frames;
+	unsigned long crc_errors;
+	unsigned long timeouts;
+	unsigned long long bytes;
+	unsigned long long usec;
+} gov_table[] = {
+	{ 9600 },
+	{ 19200 },
+	{ 38400 },
+	{ 57600 },
+	{ 115200 },
+};
+#define GOV_SPEEDS ((int)(sizeof(gov_table)/sizeof(*gov_table)))
+
+static int gov_active = 0;
+static int gov_cap;			/* highest speed allowed (index) */
+static unsigned long win_frames, win_crc, win_timeouts;
+static unsigned long long win_start;	/* window start time */
+static unsigned long long clean_since;	/* last error seen */
+static unsigned long long probe_usec = GOV_PROBE_USEC;
+static int probed_from = -1;		/* index we probed up from */
+
+static int gov_index(int speed)
+{
+	int j;
+
+	for (j = 0; j < GOV_SPEEDS; j++)
+		if (gov_table[j].speed == speed)
+			return j;
+	return GOV_SPEEDS-1;
+}
+
+static void gov_new_window(void)
+{
+	win_frames = win_crc = win_timeouts = 0;
+	win_start = get_mono_usec();
+}
+
+/* called once the serial link is up: statistics are always collected,
+ * the speed is changed only with opt_governor, never above the current one */
+void governor_start(void)
+{
+	gov_cap = gov_index(serial_speed);
+	gov_active = 1;
+	gov_new_window();
+	clean_since = win_start;
+}
+
+void governor_event(int ev)
+{
+	struct gov_speed *s;
+
+	if (!gov_active)
+		return;
+	s = &gov_table[gov_index(serial_speed)];
+	switch(ev) {
+	case GOV_EV_FRAME:
+		s->frames++;
+		win_frames++;
+		break;
+	case GOV_EV_CRC:
+		s->crc_errors++;
+		win_crc++;
+		break;
+	case GOV_EV_TIMEOUT:
+		s->timeouts++;
+		win_timeouts++;
+		break;
+	}
+}
+
+void governor_goodput(int bytes, unsigned long long usec)
+{
+	struct gov_speed *s;
+
+	if (bytes <= 0)
+		return;
+	s = &gov_table[gov_index(serial_speed)];
+	s->bytes += bytes;
+	s->usec += usec;
+}
+
+static void gov_switch(int index)
+{
+	int from = gov_index(serial_speed);
+
+	if (opt_debug)
+		printf("governor: %d -> %d bps\n", serial_speed,
+			gov_table[index].speed);
+	if (serial_relink(gov_table[index].speed) == -1)
+		printf("governor: can't switch to %d bps, staying at %d\n",
+			gov_table[index].speed, serial_speed);
+	else if (index > from)
+		probed_from = from;
+	gov_new_window();
+	clean_since = win_start;
+}
+
+/* Must be called between messages only: evaluates the last window and
+ * changes the link speed if needed. A bad frame costs the retransmission
+ * of the whole 8-fragment block, a timeout costs the whole timeout, when
+ * the time lost this way at the current speed leaves less than the
+ * nominal speed of the next slower step we step down. */
+void governor_check(void)
+{
+	unsigned long long now, elapsed, lost, frame_usec;
+	int cur;
+	double eff;
+
+	if (!gov_active || !opt_governor)
+		return;
+
+	now = get_mono_usec();
+	cur = gov_index(serial_speed);
+	if (win_crc || win_timeouts)
+		clean_since = now;
+
+	if (win_frames >= GOV_WINDOW) {
+		elapsed = now - win_start;
+		/* ~1000 bytes per frame, 10 bits per byte */
+		frame_usec = 10000ULL*1000000ULL/gov_table[cur].speed;
+		lost = win_crc*8*frame_usec +
+			win_timeouts*(unsigned long long)SERIAL_REPLY_USEC;
+		eff = elapsed ? 1.0 - (double)lost/elapsed : 1.0;
+		if (eff < 0)
+			eff = 0;
+		if (cur > 0 && gov_table[cur].speed*eff < gov_table[cur-1].speed) {
+			/* a probe that failed waits longer next time */
+			if (probed_from == cur-1 && probe_usec < GOV_PROBE_MAX)
+				probe_usec *= 2;
+			probed_from = -1;
+			gov_switch(cur-1);
+			return;
+		}
+		if (!win_crc && !win_timeouts && probed_from != -1) {
+			/* the probe survived a full window */
+			probed_from = -1;
+			probe_usec = GOV_PROBE_USEC;
+		}
+		gov_new_window();
+	}
+
+	if (cur < gov_cap && now - clean_since >= probe_usec)
+		gov_switch(cur+1);
+}
+
+void governor_stats(void)
+{
+	int j;
+
+	printf("link governor is %s, current speed %d bps\n",
+		opt_governor ? "on" : "off", serial_speed);
+	printf("%-8s %10s %10s %12s %8s %6s %8s\n", "speed", "bytes",
+		"time(ms)", "goodput(B/s)", "frames", "crc", "timeouts");
+	for (j = 0; j < GOV_SPEEDS; j++) {
+		struct gov_speed *s = &gov_table[j];
+
+		if (!s->frames && !s->bytes && !s->timeouts)
+			continue;
+		printf("%-8d %10llu %10llu %12llu %8lu %6lu %8lu\n",
+			s->speed, s->bytes, s->usec/1000,
+			s->usec ? s->bytes*1000000ULL/s->usec : 0,
+			s->frames, s->crc_errors, s->timeouts);
+	}
+	sio_stats(serial_port);
+}
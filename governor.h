@@ -0,0 +1,30 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_GOVERNOR_H
+#define S10SH_GOVERNOR_H
+
+/* link quality events */
+#define GOV_EV_FRAME	0	/* a frame was received */
+#define GOV_EV_CRC	1	/* a frame was received with bad CRC */
+#define GOV_EV_TIMEOUT	2	/* a read timed out */
+
+#define GOV_WINDOW	64		/* received frames per window */
+#define GOV_PROBE_USEC	30000000ULL	/* clean time before probing up */
+#define GOV_PROBE_MAX	480000000ULL	/* probe backoff limit */
+
+extern int opt_governor;
+
+void governor_start(void);
+void governor_event(int ev);
+void governor_goodput(int bytes, unsigned long long usec);
+void governor_check(void);
+void governor_stats(void);
+
+#endif /* S10SH_GOVERNOR_H */
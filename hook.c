@@ -0,0 +1,345 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Post download hooks: with -x every downloaded file is a job for a
+ * command, run by /bin/sh with the path as $1 and the listing data in
+ * the environment. Up to hook_jobs (-j) of them run at the same time
+ * while the next files are transferred; the others wait in a bounded
+ * queue, a download waits for a free place when it is full. Finished
+ * hooks are looked for while the data arrives, at most every
+ * HOOK_POLL_USEC, and a free slot takes the next job at once. With -f a
+ * job waits for the group commit that gives the file its name. At exit
+ * s10sh waits for all of them.
+ *
+ * -F frees the card in the same pass: once the group commit made a
+ * file durable, a job of the pool reads it back from the disk and
+ * checks its size and SHA-256 against the download, and only then the
+ * file goes in the list of the deletes, issued on the camera between
+ * two downloads.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "s10sh.h"
+
+char *hook_cmd = NULL;		/* -x */
+int hook_jobs = HOOK_JOBS;	/* -j */
+int opt_free = 0;		/* -F */
+
+struct job {
+	char path[1024];
+	char camera_path[1024];
+	unsigned int size;
+	time_t date;
+	char sha256[SHA256_LEN*2+1];	/* empty without -H */
+	unsigned long after;		/* the commit that publishes it, -f */
+	unsigned long long queued, started;
+	pid_t pid;
+	int verify;			/* -F, not the -x command */
+	int lost;			/* its commit failed, never run */
+};
+
+static struct job queue[HOOK_QUEUE];	/* a ring */
+static int queue_head = 0, queue_len = 0;
+static struct job running[HOOK_JOBS_MAX];
+static int nrunning = 0;
+static int queue_max = 0;
+static unsigned long long last_poll = 0;
+
+/* -F, verified copies, to delete on the camera */
+static char **frees = NULL;
+static int nfrees = 0, frees_alloc = 0;
+
+/* The copy as it is on the disk, not in the page cache: the pages are
+ * clean after the commit and can be dropped first. */
+static int verify_copy(struct job *j)
+{
+	unsigned char buf[65536], digest[SHA256_LEN];
+	char hex[SHA256_LEN*2+1];
+	struct sha256 c;
+	unsigned long long total = 0;
+	int fd, n;
+
+	fd = open(j->path, O_RDONLY);
+	if (fd == -1) {
+		perror(j->path);
+		return 1;
+	}
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	sha256_init(&c);
+	while((n = read(fd, buf, sizeof(buf))) > 0) {
+		sha256_update(&c, buf, n);
+		total += n;
+	}
+	if (n == -1)
+		perror(j->path);
+	close(fd);
+	sha256_final(&c, digest);
+	if (n == -1 || total != j->size ||
+	    strcmp(sha256_hex(digest, hex), j->sha256)) {
+		printf("===WARNING===> %s: the copy is not the download, "
+			"%llu of %u bytes\n", j->path, total, j->size);
+		return 1;
+	}
+	return 0;
+}
+
+/* the child: nothing of s10sh but stdin, stdout and stderr, a FIFO
+ * reader must see the end of the data */
+static void hook_exec(struct job *j)
+{
+	char buf[32];
+	int fd, n, max = sysconf(_SC_OPEN_MAX);
+
+	if (max < 0 || max > 1024)
+		max = 1024;
+	for (fd = 3; fd < max; fd++)
+		close(fd);
+	signal(SIGPIPE, SIG_DFL);
+	if (j->verify) {
+		n = verify_copy(j);
+		fflush(stdout);
+		_exit(n);
+	}
+	setenv("S10SH_FILE", j->path, 1);
+	setenv("S10SH_CAMERA_FILE", j->camera_path, 1);
+	snprintf(buf, sizeof(buf), "%u", j->size);
+	setenv("S10SH_SIZE", buf, 1);
+	snprintf(buf, sizeof(buf), "%lu", (unsigned long)j->date);
+	setenv("S10SH_DATE", buf, 1);
+	if (j->sha256[0])
+		setenv("S10SH_SHA256", j->sha256, 1);
+	execl("/bin/sh", "sh", "-c", hook_cmd, "s10sh-hook", j->path, NULL);
+	perror("/bin/sh");
+	_exit(127);
+}
+
+static void hook_start(struct job *j)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == -1) {
+		perror("hook fork");
+		metrics_count(MET_HOOK_ERRORS, 1);
+		if (j->verify)
+			printf("===WARNING===> %s: not verified, kept on "
+				"the camera\n", j->camera_path);
+		return;
+	}
+	if (pid == 0)
+		hook_exec(j);
+	j->pid = pid;
+	j->started = get_mono_usec();
+	running[nrunning++] = *j;
+}
+
+static void free_add(char *camera_path)
+{
+	if (nfrees == frees_alloc) {
+		frees_alloc = frees_alloc ? frees_alloc*2 : 64;
+		frees = realloc(frees, sizeof(char*)*frees_alloc);
+		if (!frees) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	frees[nfrees] = strdup(camera_path);
+	if (!frees[nfrees]) {
+		perror("strdup");
+		exit(1);
+	}
+	nfrees++;
+}
+
+/* the hooks that are over, waiting for one if block */
+static void hook_reap(int block)
+{
+	unsigned long long now;
+	int status, k;
+	pid_t pid;
+
+	while(nrunning) {
+		pid = waitpid(-1, &status, block ? 0 : WNOHANG);
+		if (pid == 0 || (pid == -1 && errno != EINTR))
+			return;
+		if (pid == -1)
+			continue;
+		for (k = 0; k < nrunning && running[k].pid != pid; k++)
+			;
+		if (k == nrunning)
+			continue;	/* not a hook, an old viewer */
+		now = get_mono_usec();
+		metrics_observe(MET_HOOK, now - running[k].started);
+		metrics_count(MET_HOOKS, 1);
+		if (running[k].verify) {
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+				free_add(running[k].camera_path);
+			else
+				printf("===WARNING===> %s: not verified, kept "
+					"on the camera\n",
+					running[k].camera_path);
+		} else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			metrics_count(MET_HOOK_ERRORS, 1);
+			if (WIFEXITED(status))
+				printf("===WARNING===> hook: %s: exit %d\n",
+					running[k].path, WEXITSTATUS(status));
+			else
+				printf("===WARNING===> hook: %s: signal %d\n",
+					running[k].path, WTERMSIG(status));
+		}
+		running[k] = running[--nrunning];
+		block = 0;
+	}
+}
+
+/* Start the jobs there is room for, in order. One that waits for a
+ * group commit stops the ones after it. */
+void hook_poll(void)
+{
+	struct job *j;
+
+	last_poll = get_mono_usec();
+	hook_reap(0);
+	while(queue_len && nrunning < hook_jobs) {
+		j = &queue[queue_head];
+		if (j->after > commit_done)
+			break;
+		if (!j->lost) {
+			metrics_observe(MET_HOOK_WAIT, last_poll - j->queued);
+			hook_start(j);
+		}
+		queue_head = (queue_head+1) % HOOK_QUEUE;
+		queue_len--;
+	}
+}
+
+/* cheap, from the transfer loops */
+void hook_check(void)
+{
+	if ((queue_len || nrunning) &&
+	    get_mono_usec() - last_poll >= HOOK_POLL_USEC)
+		hook_poll();
+}
+
+/* When the queue is full the download waits for a hook to end: the
+ * host can't keep up, no point in getting further ahead. */
+static void hook_queue(char *path, char *camera_path, unsigned int size,
+	time_t date, char *sha256, int verify)
+{
+	struct job *j;
+
+	hook_poll();
+	while(queue_len == HOOK_QUEUE) {
+		if (out_pending())
+			out_commit(1);
+		hook_poll();
+		if (queue_len < HOOK_QUEUE)
+			break;
+		hook_reap(1);
+		hook_poll();
+	}
+	j = &queue[(queue_head+queue_len) % HOOK_QUEUE];
+	memset(j, 0, sizeof(*j));
+	snprintf(j->path, sizeof(j->path), "%s", path);
+	snprintf(j->camera_path, sizeof(j->camera_path), "%s", camera_path);
+	j->size = size;
+	j->date = date;
+	if (sha256)
+		snprintf(j->sha256, sizeof(j->sha256), "%s", sha256);
+	j->after = out_pending() ? commit_done+1 : commit_done;
+	j->queued = get_mono_usec();
+	j->verify = verify;
+	queue_len++;
+	metrics_observe(MET_HOOK_QUEUE, queue_len + nrunning);
+	if (queue_len + nrunning > queue_max)
+		queue_max = queue_len + nrunning;
+	hook_poll();
+}
+
+/* the file at path is written */
+void hook_submit(char *path, char *camera_path, unsigned int size,
+	time_t date, char *sha256)
+{
+	if (hook_cmd)
+		hook_queue(path, camera_path, size, date, sha256, 0);
+}
+
+/* -F, the file at path is to be checked and then freed */
+void hook_verify(char *path, char *camera_path, unsigned int size,
+	char *sha256)
+{
+	hook_queue(path, camera_path, size, 0, sha256, 1);
+}
+
+/* The verified files go away from the camera, between two commands
+ * on the link. */
+void free_run(void)
+{
+	unsigned long long start;
+	int j;
+
+	for (j = 0; j < nfrees; j++) {
+		start = get_mono_usec();
+		if (camera_delete_file(frees[j]) == 0) {
+			printf("%s: freed\n", frees[j]);
+			metrics_count(MET_FREED, 1);
+			xferlog("delete", frees[j], 0,
+				get_mono_usec() - start);
+		} else {
+			printf("===WARNING===> %s: delete failed\n",
+				frees[j]);
+		}
+		free(frees[j]);
+	}
+	nfrees = 0;
+}
+
+/* from out_commit(), the file at path didn't make it: its jobs waiting
+ * for the commit are not run, not even -F */
+void hook_lost(char *path)
+{
+	struct job *j;
+	int k;
+
+	for (k = 0; k < queue_len; k++) {
+		j = &queue[(queue_head+k) % HOOK_QUEUE];
+		if (j->after > commit_done && !strcmp(j->path, path))
+			j->lost = 1;
+	}
+}
+
+/* all the hooks done, at exit */
+void hook_wait(void)
+{
+	if (!queue_len && !nrunning)
+		return;
+	printf("waiting for %d hooks\n", queue_len + nrunning);
+	out_commit(1);
+	for (hook_poll(); queue_len || nrunning; hook_poll())
+		hook_reap(1);
+}
+
+void hook_stats(void)
+{
+	if (!hook_cmd && !opt_free)
+		return;
+	hook_poll();
+	printf("hooks: %d running, %d queued, at most %d, %d at a time\n",
+		nrunning, queue_len, queue_max, hook_jobs);
+}
@@ -0,0 +1,35 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_HOOK_H
+#define S10SH_HOOK_H
+
+#include <time.h>
+
+#define HOOK_JOBS	2	/* hooks at the same time, -j */
+#define HOOK_JOBS_MAX	32
+#define HOOK_QUEUE	64	/* files waiting for a hook */
+#define HOOK_POLL_USEC	20000	/* finished hooks looked for, at most */
+
+extern char *hook_cmd;
+extern int hook_jobs;
+extern int opt_free;
+
+void hook_submit(char *path, char *camera_path, unsigned int size,
+	time_t date, char *sha256);
+void hook_verify(char *path, char *camera_path, unsigned int size,
+	char *sha256);
+void free_run(void);
+void hook_lost(char *path);
+void hook_poll(void);
+void hook_check(void);
+void hook_wait(void);
+void hook_stats(void);
+
+#endif /* S10SH_HOOK_H */
@@ -0,0 +1,394 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * The transfer journal of -J: getall and getnew write down the files
+ * they are going to get, then the one in flight and the ones done, a
+ * text line each, only appended. A run that stopped half way, for a
+ * crash, a kill or a pulled cable, is continued by the next one with
+ * the same journal: no listing of the card, only the files not done,
+ * starting from the one that was in flight. A file is done when it is
+ * published, with the group commit that makes it durable: the journal
+ * never says done for a file a crash can still lose.
+ *
+ * The lines, fields separated by tabs:
+ *
+ *	s10sh-journal 1
+ *	camera	<id>
+ *	plan	<folder>	<name>	<size>	<date>	<attributes>
+ *	ready	<files>
+ *	start	<folder>\<name>
+ *	tmp	<temporary file>
+ *	done	<folder>\<name>
+ *	end
+ *
+ * A last line without its newline was cut by a crash and is dropped.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "s10sh.h"
+
+char *journal_file = NULL;	/* -J */
+
+#define J_PLANNED	0
+#define J_STARTED	1	/* in flight when the run stopped */
+#define J_DONE		2
+
+struct jentry {
+	char *folder;		/* lastpath of the listing */
+	char *name;
+	unsigned int size;
+	time_t date;		/* as in the listing, GMT offset in */
+	unsigned char type;
+	int state;
+};
+
+static FILE *jf = NULL;
+static struct jentry *plan = NULL;
+static int nplan = 0, plan_alloc = 0;
+static int hint = 0;		/* where the next lookup starts */
+static int ready = 0, ended = 0;
+static char camera[1024];
+static char **tmps = NULL;	/* left by the run that stopped */
+static int ntmps = 0;
+static int current = -1;	/* the file in flight */
+static struct {
+	int plan;
+	char path[1024];		/* the copy on the disk */
+} queued[COMMIT_MAX];		/* done, waiting for the group commit */
+static int nqueued = 0;
+
+static char *xstrdup(char *s)
+{
+	char *p = strdup(s);
+
+	if (!p) {
+		perror("strdup");
+		exit(1);
+	}
+	return p;
+}
+
+static void plan_add(char *folder, char *name, unsigned int size,
+	time_t date, unsigned char type)
+{
+	struct jentry *e;
+
+	if (nplan == plan_alloc) {
+		plan_alloc = plan_alloc ? plan_alloc*2 : 1024;
+		plan = realloc(plan, sizeof(struct jentry)*plan_alloc);
+		if (!plan) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	e = &plan[nplan++];
+	/* the entries of a folder share its name */
+	if (nplan > 1 && !strcmp(plan[nplan-2].folder, folder))
+		e->folder = plan[nplan-2].folder;
+	else
+		e->folder = xstrdup(folder);
+	e->name = xstrdup(name);
+	e->size = size;
+	e->date = date;
+	e->type = type;
+	e->state = J_PLANNED;
+}
+
+static int entry_is(struct jentry *e, char *path)
+{
+	int len = strlen(e->folder);
+
+	return !strncmp(path, e->folder, len) && path[len] == '\\' &&
+		!strcmp(path+len+1, e->name);
+}
+
+/* The files are done in the order of the plan, the lookup starts from
+ * the last one found. */
+static int plan_find(char *path)
+{
+	int j, k;
+
+	for (j = 0; j < nplan; j++) {
+		k = (hint + j) % nplan;
+		if (entry_is(&plan[k], path)) {
+			hint = k;
+			return k;
+		}
+	}
+	return -1;
+}
+
+static void journal_line(char *line)
+{
+	char *f[6];
+	int n, j;
+
+	for (n = 0, f[0] = line; n < 5 && (f[n+1] = strchr(f[n], '\t')); n++)
+		*f[n+1]++ = '\0';
+	n++;
+	if (!strcmp(f[0], "camera") && n == 2) {
+		snprintf(camera, sizeof(camera), "%s", f[1]);
+	} else if (!strcmp(f[0], "plan") && n == 6) {
+		plan_add(f[1], f[2], strtoul(f[3], NULL, 10),
+			strtol(f[4], NULL, 10), atoi(f[5]));
+	} else if (!strcmp(f[0], "ready")) {
+		ready = 1;
+	} else if (!strcmp(f[0], "start") && n == 2) {
+		if ((j = plan_find(f[1])) != -1 && plan[j].state != J_DONE)
+			plan[j].state = J_STARTED;
+	} else if (!strcmp(f[0], "tmp") && n == 2) {
+		tmps = realloc(tmps, sizeof(char*)*(ntmps+1));
+		if (!tmps) {
+			perror("realloc");
+			exit(1);
+		}
+		tmps[ntmps++] = xstrdup(f[1]);
+	} else if (!strcmp(f[0], "done") && n == 2) {
+		if ((j = plan_find(f[1])) != -1)
+			plan[j].state = J_DONE;
+	} else if (!strcmp(f[0], "end")) {
+		ended = 1;
+	}
+}
+
+static void journal_sync(void)
+{
+	if (fflush(jf) == EOF || fsync(fileno(jf)) == -1)
+		perror(journal_file);
+}
+
+/* -J path: what the last run did, up to its last whole line */
+int journal_open(char *path)
+{
+	char line[4096];
+	long good = 0;
+	int fd, len;
+
+	fd = open(path, O_RDWR|O_CREAT, 0644);
+	if (fd == -1 || (jf = fdopen(fd, "r+")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	journal_file = path;
+	while(fgets(line, sizeof(line), jf)) {
+		len = strlen(line);
+		if (line[len-1] != '\n')
+			break;
+		line[len-1] = '\0';
+		if (good == 0 && strcmp(line, JOURNAL_MAGIC)) {
+			printf("%s: not a journal of s10sh\n", path);
+			fclose(jf);
+			jf = NULL;
+			return -1;
+		}
+		journal_line(line);
+		good += len;
+	}
+	if (ftruncate(fd, good) == -1 || fseek(jf, good, SEEK_SET) == -1) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Returns 1 if there is a run to continue, on this camera. Else the
+ * journal starts again, empty. */
+int journal_resume(void)
+{
+	int j;
+
+	/* the temporary files of a stopped run are never published */
+	for (j = 0; j < ntmps; j++) {
+		unlink(tmps[j]);
+		free(tmps[j]);
+	}
+	ntmps = 0;
+	if (ready && !ended && !strcmp(camera, cameraid))
+		return 1;
+	if (ready && !ended)
+		printf("%s: a run of %s, not of this camera, starting again\n",
+			journal_file, camera);
+	for (j = 0; j < nplan; j++) {
+		if (j == 0 || plan[j].folder != plan[j-1].folder)
+			free(plan[j].folder);
+		free(plan[j].name);
+	}
+	nplan = hint = 0;
+	ready = ended = 0;
+	if (ftruncate(fileno(jf), 0) == -1)
+		perror(journal_file);
+	rewind(jf);
+	fprintf(jf, "%s\ncamera\t%s\n", JOURNAL_MAGIC, cameraid);
+	fflush(jf);
+	return 0;
+}
+
+/* the 'which' files of the last ls go in the plan */
+void journal_plan(int which)
+{
+	int j;
+
+	for (j = 0; j < dirlist_size; j++) {
+		if (!last_ls_selected(j, which))
+			continue;
+		plan_add(lastpath, dirlist[j]->name, dirlist[j]->size,
+			dirlist[j]->date, dirlist[j]->type);
+		fprintf(jf, "plan\t%s\t%s\t%u\t%ld\t%d\n", lastpath,
+			dirlist[j]->name, dirlist[j]->size,
+			(long)dirlist[j]->date, dirlist[j]->type);
+	}
+}
+
+/* the plan is complete, and on the disk */
+void journal_ready(void)
+{
+	fprintf(jf, "ready\t%d\n", nplan);
+	journal_sync();
+	ready = 1;
+}
+
+/* Get the files of the plan not done yet. The listing of every folder
+ * comes from the journal, not from the camera. */
+int journal_run(void)
+{
+	unsigned long long bytes = 0;
+	struct canonfile f;
+	char saved[1024], path[2048];
+	int i, j, k, files = 0, left = 0;
+
+	for (j = 0; j < nplan; j++) {
+		if (plan[j].state == J_DONE)
+			continue;
+		files++;
+		bytes += plan[j].size;
+	}
+	if (files < nplan)
+		printf("%s: %d of %d files left\n", journal_file, files, nplan);
+	snprintf(saved, sizeof(saved), "%s", lastpath);
+	progress_batch_begin(files, bytes);
+	for (j = 0; j < nplan; j = k) {
+		/* the files of a folder are one after the other */
+		for (k = j; k < nplan && plan[k].folder == plan[j].folder; k++)
+			;
+		for (i = j; i < k && plan[i].state == J_DONE; i++)
+			;
+		if (i == k)
+			continue;
+		printf("---> %s\n", plan[j].folder);
+		snprintf(lastpath, sizeof(lastpath), "%s", plan[j].folder);
+		dirlist_clear();
+		for (i = j; i < k; i++) {
+			f.type = plan[i].type;
+			f.size = plan[i].size;
+			f.date = plan[i].date;
+			snprintf(f.name, sizeof(f.name), "%s", plan[i].name);
+			dirlist_add(&f);
+		}
+		for (i = j; i < k; i++) {
+			if (plan[i].state == J_DONE)
+				continue;
+			snprintf(path, sizeof(path), "%s\\%s", plan[i].folder,
+				plan[i].name);
+			if (plan[i].state == J_STARTED)
+				printf("%s: not done when the run stopped, "
+					"getting it again\n", path);
+			fprintf(jf, "start\t%s\n", path);
+			fflush(jf);
+			plan[i].state = J_STARTED;
+			current = i;
+			camera_get_image(path, NULL);
+			current = -1;
+			printf("\n");
+		}
+	}
+	progress_batch_end();
+	out_commit(1);
+	snprintf(lastpath, sizeof(lastpath), "%s", saved);
+
+	for (j = 0; j < nplan; j++)
+		if (plan[j].state != J_DONE)
+			left++;
+	if (left) {
+		printf("%s: %d files not downloaded, run again to get "
+			"them\n", journal_file, left);
+		return -1;
+	}
+	fprintf(jf, "end\n");
+	journal_sync();
+	ended = 1;
+	return 0;
+}
+
+/* the temporary name of the file in flight, to remove if it stops */
+void journal_tmp(char *tmp)
+{
+	if (!jf || current == -1)
+		return;
+	fprintf(jf, "tmp\t%s\n", tmp);
+	fflush(jf);
+}
+
+/* The file in flight is published as path, or was already there. With
+ * a group commit in progress it is done when the commit is. */
+void journal_done(char *pathname, char *path)
+{
+	if (!jf || current == -1 || !entry_is(&plan[current], pathname))
+		return;
+	plan[current].state = J_DONE;
+	if (out_pending()) {
+		if (nqueued == COMMIT_MAX)
+			out_commit(1);
+		queued[nqueued].plan = current;
+		snprintf(queued[nqueued].path, sizeof(queued[0].path), "%s",
+			path);
+		nqueued++;
+		return;
+	}
+	fprintf(jf, "done\t%s\n", pathname);
+	journal_sync();
+}
+
+/* from out_commit(), the files of the group are durable */
+void journal_commit(void)
+{
+	int j;
+
+	if (!jf || !nqueued)
+		return;
+	for (j = 0; j < nqueued; j++)
+		fprintf(jf, "done\t%s\\%s\n", plan[queued[j].plan].folder,
+			plan[queued[j].plan].name);
+	nqueued = 0;
+	journal_sync();
+}
+
+/* from out_commit(), the copy at path didn't make it: not done */
+void journal_lost(char *path)
+{
+	int j;
+
+	for (j = 0; j < nqueued; j++) {
+		if (strcmp(queued[j].path, path))
+			continue;
+		plan[queued[j].plan].state = J_STARTED;
+		queued[j] = queued[--nqueued];
+		return;
+	}
+}
+
+void journal_close(void)
+{
+	if (!jf)
+		return;
+	fclose(jf);
+	jf = NULL;
+}
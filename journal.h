@@ -0,0 +1,28 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_JOURNAL_H
+#define S10SH_JOURNAL_H
+
+#define JOURNAL_MAGIC	"s10sh-journal 1"
+
+extern char *journal_file;
+
+int journal_open(char *path);
+int journal_resume(void);
+void journal_plan(int which);
+void journal_ready(void);
+int journal_run(void);
+void journal_tmp(char *tmp);
+void journal_done(char *pathname, char *path);
+void journal_commit(void);
+void journal_lost(char *path);
+void journal_close(void);
+
+#endif /* S10SH_JOURNAL_H */
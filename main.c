@@ -41,8 +41,8 @@
 int opt_debug = 0;
 int opt_overwrite = 0;
 char prompt[1024];
-struct canonfile *dirlist[1024];
-int dirlist_size = 0;
+struct canonfile **dirlist = NULL;
+int dirlist_size = 0, dirlist_alloc = 0;
 char lastpath[1024] = {'\0'};
 char cameraid[1024];
 char dcimpath[1024] = { "D:\\DCIM" };
@@ -58,9 +58,6 @@ int DANGER = 0;		 /* Used by usb.c to bypass safe camera detection */
 
 int main(int argc, char **argv)
 {
-#ifndef HAVE_READLINE
-	char buffer[1024];
-#endif
 	char command[1024];
 	char *command_argv[COMMANDARGS_MAX+1] = { NULL };
 	int command_argc;
@@ -73,6 +70,8 @@ int main(int argc, char **argv)
 	signal(SIGQUIT, signal_trap);
 	signal(SIGSEGV, signal_trap);
 	signal(SIGFPE, signal_trap);
+	trace_init(NULL);
+	metrics_reset();
 
 	/* Determine the difference in seconds we are from GMT depending upon
 	** /etc/localtime or $TZ. This is used to "adjust" the date values we
@@ -80,7 +79,7 @@ int main(int argc, char **argv)
 	*/
 	GMT_offset = offset_from_GMT();
 	
-        while ((c = getopt(argc, argv, "d:DulgEhUas:Lni:tcZS")) != EOF) {
+        while ((c = getopt(argc, argv, "d:DulgEhUas:Lni:tcZSGkr:R:V:X:B:M:P:o:b:T:f:H:N:x:j:FJ:W:")) != EOF) {
 		switch(c) {
 		case 'D':
 			opt_debug = 1;
@@ -124,6 +123,13 @@ int main(int argc, char **argv)
 			opt_a50 = 1;
 			printf("A50/Pro70 compatibility mode enabled\n");
 			break;
+		case 'k':
+			opt_keep_pcmode = 1;
+			break;
+		case 'G':
+			opt_governor = 1;
+			printf("serial link governor enabled\n");
+			break;
 		case 's':
 			serial_change_speed(atoi(optarg));
 			break;
@@ -139,6 +145,99 @@ int main(int argc, char **argv)
 		case 'Z':
 			DANGER = 1;
 			break;
+		case 'r':
+		case 'R':
+#ifdef HAVE_USB_SUPPORT
+			if (usbtrace_mode != USBTRACE_OFF) {
+				printf("-r and -R can't be used together\n");
+				exit(1);
+			}
+			if (c == 'r' && usbtrace_record_open(optarg) == -1)
+				exit(1);
+			if (c == 'R' && usbtrace_replay_open(optarg) == -1)
+				exit(1);
+			if (c == 'R')
+				mode = USB_MODE;
+#else
+			printf("This binary lacks the USB support\n");
+			exit(1);
+#endif
+			break;
+		case 'X':
+			if (xferlog_open(optarg) == -1)
+				exit(1);
+			break;
+		case 'B':
+			trace_init(optarg);
+			break;
+		case 'M':
+			metrics_export_open(optarg);
+			break;
+		case 'P':
+			opt_output = xfer_mode(optarg);
+			if (opt_output == -1) {
+				printf("-P wants write, pwrite or mmap\n");
+				exit(1);
+			}
+			break;
+		case 'o':
+			if (sink_open(optarg, 1) == -1)
+				exit(1);
+			break;
+		case 'b':
+			sink_buffer = sink_size(optarg);
+			break;
+		case 'T':
+			if (sink_tar_open(optarg) == -1)
+				exit(1);
+			break;
+		case 'f':
+			if (out_commit_policy(optarg) == -1)
+				exit(1);
+			break;
+		case 'H':
+			if (manifest_open(optarg) == -1)
+				exit(1);
+			break;
+		case 'N':
+			if (out_template(optarg) == -1)
+				exit(1);
+			break;
+		case 'x':
+			hook_cmd = optarg;
+			break;
+		case 'F':
+			opt_free = 1;
+			break;
+		case 'J':
+			if (journal_open(optarg) == -1)
+				exit(1);
+			break;
+		case 'W':
+			reconnect_secs = atoi(optarg);
+			if (reconnect_secs < 1) {
+				printf("-W wants the seconds to wait\n");
+				exit(1);
+			}
+			break;
+		case 'j':
+			hook_jobs = atoi(optarg);
+			if (hook_jobs < 1 || hook_jobs > HOOK_JOBS_MAX) {
+				printf("-j wants 1 to %d hooks\n",
+					HOOK_JOBS_MAX);
+				exit(1);
+			}
+			break;
+		case 'V':
+#ifdef HAVE_USB_SUPPORT
+			if (vcam_open(optarg) == -1)
+				exit(1);
+			mode = VIRTUAL_MODE;
+#else
+			printf("This binary lacks the USB support\n");
+			exit(1);
+#endif
+			break;
                 case 'h':
                 default:
 			show_usage();
@@ -146,6 +245,9 @@ int main(int argc, char **argv)
                         break;
 	 	}
 	}
+	/* -F deletes and -J says done only what is on the disk for good */
+	if ((opt_free || journal_file) && commit_count == 0)
+		commit_count = COMMIT_SAFE;
 
 	printf(
 	"S10sh -- version %s\n"
@@ -258,20 +360,32 @@ int main(int argc, char **argv)
 	while(1) {
 		char *p, *cmd;
 
+		/* no file waits for its group at the prompt */
+		out_commit(1);
+		/* -W: the last command lost the camera */
+		camera_recover();
+		hook_poll();
+		metrics_export(0);
 		snprintf(prompt, 1024, "[%s] %s> ", cameraid, lastpath);
 #ifdef HAVE_READLINE
                 p = readline(prompt);
-                if (!p) continue;
+                if (!p) {
+			/* end of input, a script or ^D */
+			printf("\n");
+			safe_exit(0);
+		}
                 if (p[0] != '\0')
                         add_history(p);
                 strncpy(command, p, 1024);
                 free(p);
 #else
                 printf(prompt);
-                if (fgets(command, 1024, stdin) == NULL)
-                        continue;
+                if (fgets(command, 1024, stdin) == NULL) {
+			printf("\n");
+			safe_exit(0);
+		}
                 command[1023] = '\0';
-                if ((p = strchr(buffer, '\n')) != NULL)
+                if ((p = strchr(command, '\n')) != NULL)
                         *p = '\0';
 #endif /* HAVE_READLINE */
 
@@ -285,6 +399,7 @@ int main(int argc, char **argv)
 		if (command_argc == 0)
 			continue;
                 cmd = command_argv[0]; /* cmd is argv[0] */
+		trace_mark(command);
 
 #define CHECK_ARGS(x) 	if (command_argc != x) \
 			{ \
@@ -297,6 +412,32 @@ int main(int argc, char **argv)
 		} else if (!strcmp(cmd, "quit") || !strcmp(cmd, "exit") || !strcmp(cmd, "bye")) {
 			printf("bye!\n");
 			safe_exit(0);
+		} else if (!strcmp(cmd, "stats")) {
+			if (command_argc == 2 && !strcmp(command_argv[1], "reset"))
+				metrics_reset();
+			else {
+				metrics_show();
+				hook_stats();
+			}
+		} else if (!strcmp(cmd, "trace")) {
+			if (command_argc >= 2 && !strcmp(command_argv[1], "dump")) {
+				char *file = command_argc == 3 ?
+					command_argv[2] : trace_file;
+
+				if (trace_dump(file) == -1)
+					perror("trace dump");
+				else
+					printf("trace dumped to %s\n", file);
+			} else if (command_argc == 2 &&
+				   !strcmp(command_argv[1], "clear")) {
+				trace_clear();
+			} else if (command_argc == 2 &&
+				   !strcmp(command_argv[1], "hex")) {
+				trace_show(20, 1);
+			} else {
+				trace_show(command_argc == 2 ?
+					atoi(command_argv[1]) : 20, 0);
+			}
 		} else if (!strcmp(cmd, "debug")) {
 			opt_debug = !opt_debug;
 			if (opt_debug) {
@@ -315,7 +456,7 @@ int main(int argc, char **argv)
 				printf("firmware : %s\n", firmware);
 				printf("Owner    : %s\n", camera_owner);
 			}
-			if (mode == USB_MODE) {
+			if (mode != SERIAL_MODE) {
 			   bid = USB_body_id();
 			   if (bid == NULL) {
 				printf("error getting the Bid\n");
@@ -358,7 +499,7 @@ int main(int argc, char **argv)
                                 printf("camera ID: %s\n", id);
                                 printf("firmware : %s\n", firmware);
                                 printf("Owner    : %s\n", id+32);
-	                        if (mode == USB_MODE) {
+	                        if (mode != SERIAL_MODE) {
         	                   bid = USB_body_id();
                 	           if (bid == NULL) {
                         	        /*printf("error getting the Bid\n");*/
@@ -451,6 +592,32 @@ int main(int argc, char **argv)
 			}
 		} else if (!strcmp(cmd, "ping")) {
 			camera_ping();
+		} else if (!strcmp(cmd, "linkbench")) {
+			int chunks[LINKBENCH_CHUNKS_MAX] = { 512, 1024, 2048, 4096 };
+			int nchunks = 4, repeats = 3, j;
+
+			if (command_argc >= 3)
+				repeats = atoi(command_argv[2]);
+			if (repeats < 1 || repeats > LINKBENCH_REPEATS_MAX) {
+				printf("1 to %d repeats\n", LINKBENCH_REPEATS_MAX);
+				continue;
+			}
+			if (command_argc >= 4) {
+				nchunks = command_argc - 3;
+				if (nchunks > LINKBENCH_CHUNKS_MAX)
+					nchunks = LINKBENCH_CHUNKS_MAX;
+				for (j = 0; j < nchunks; j++) {
+					chunks[j] = atoi(command_argv[3+j]);
+					if (chunks[j] < 64 || chunks[j] > 0x100000)
+						break;
+				}
+				if (j < nchunks) {
+					printf("chunk sizes from 64 to 1048576\n");
+					continue;
+				}
+			}
+			camera_linkbench(command_argc >= 2 ? command_argv[1] :
+				NULL, repeats, chunks, nchunks);
 		} else if (!strcmp(cmd, "diskinfo")) {
 			int size, free, result = 0;
 			CHECK_ARGS(2)
@@ -472,12 +639,17 @@ int main(int argc, char **argv)
 				printf("ls error\n");
 			}
 		} else if (!strcmp(cmd, "get")) {
-			CHECK_ARGS(2);
-			if (camera_get_image(command_argv[1], NULL) == -1) {
+			if (command_argc < 2) {
+				printf("not enough arguments\n");
+				continue;
+			}
+			if (sink_command(command_argc-2, command_argv+2) == -1 ||
+			    camera_get_image(command_argv[1], NULL) == -1) {
 				printf("get error\n");
 			} else {
 				printf("get successful\n");
 			}
+			sink_release();
 		} else if (!strcmp(cmd, "tget")) {
 			CHECK_ARGS(2);
 			if (camera_get_thumb(command_argv[1], NULL) == -1) {
@@ -492,12 +664,17 @@ int main(int argc, char **argv)
 			view_all();
 		} else if (!strcmp(cmd, "lastls")) {
 			camera_last_ls();
-		} else if (!strcmp(cmd, "getlastls")|| !strcmp(cmd, "getall")) {
-			camera_get_last_ls(WHICH_ALL);
-		} else if (!strcmp(cmd, "getallold")) {
-			camera_get_last_ls(WHICH_OLD);
-		} else if (!strcmp(cmd, "getallnew")) {
-			camera_get_last_ls(WHICH_NEW);
+		} else if (!strcmp(cmd, "getlastls")|| !strcmp(cmd, "getall") ||
+			   !strcmp(cmd, "getallold") || !strcmp(cmd, "getallnew")) {
+			int which = WHICH_ALL;
+
+			if (!strcmp(cmd, "getallold"))
+				which = WHICH_OLD;
+			else if (!strcmp(cmd, "getallnew"))
+				which = WHICH_NEW;
+			if (sink_command(command_argc-1, command_argv+1) == 0)
+				camera_get_last_ls(which);
+			sink_release();
 		} else if (!strcmp(cmd, "open")) {
 			if (mode == SERIAL_MODE)
 				serial_open();
@@ -505,7 +682,10 @@ int main(int argc, char **argv)
 				printf("Not implemented with USB\n");
 		} else if (!strcmp(cmd, "reopen")) {
 			if (mode == SERIAL_MODE) {
-				serial_close();
+				if (opt_keep_pcmode)
+					serial_suspend();
+				else
+					serial_close();
 				serial_open();
 			} else {
 				printf("Not implemented with USB\n");
@@ -568,9 +748,16 @@ int main(int argc, char **argv)
 			if (mode == SERIAL_MODE) {
 				if (command_argc == 2) {
 					serial_change_speed(atoi(command_argv[1]));
-					if (old_speed != serial_speed) {
-						serial_close();
-						serial_open();
+					if (old_speed != serial_speed && fd != -1) {
+						int new_speed = serial_speed;
+
+						/* in place, reopen only if needed */
+						serial_speed = old_speed;
+						if (serial_relink(new_speed) == -1) {
+							serial_speed = new_speed;
+							serial_close();
+							serial_open();
+						}
 					}
 				} else {
 					serial_change_speed(0);
@@ -578,6 +765,27 @@ int main(int argc, char **argv)
 			} else {
 				printf("Not implemented with USB\n");
 			}
+		} else if (!strcmp(cmd, "pace")) {
+			if (command_argc >= 2 && atoi(command_argv[1]) > 0)
+				serial_pace_chunk = atoi(command_argv[1]);
+			if (command_argc >= 3)
+				serial_pace_gap = atoi(command_argv[2]);
+			serial_pace_stats();
+		} else if (!strcmp(cmd, "governor")) {
+			if (mode != SERIAL_MODE) {
+				printf("Not implemented with USB\n");
+			} else if (command_argc == 2) {
+				if (!strcmp(command_argv[1], "on")) {
+					opt_governor = 1;
+					governor_start();
+				} else if (!strcmp(command_argv[1], "off")) {
+					opt_governor = 0;
+				} else {
+					printf("usage: governor [on|off]\n");
+				}
+			} else {
+				governor_stats();
+			}
 		} else if (!strcmp(cmd, "help")) {
 			if (command_argc != 2) show_help();
 			else if (!strcmp(command_argv[1], "param")) param_help(0,23);
@@ -671,16 +879,19 @@ int main(int argc, char **argv)
 			camera_file_chmod_all(CHMOD_CLEAR, ATTR_NEW);
 		} else if (!strcmp(cmd, "upload") || !strcmp(cmd, "put")) {
 			int retval;
+			unsigned long long start = get_mono_usec();
+			struct stat st;
+
 			if (command_argc == 2) {
 #ifdef HAVE_USB_SUPPORT
-				if (mode == USB_MODE)
+				if (mode != SERIAL_MODE)
 					retval = USB_upload(command_argv[1], NULL);
 				else
 #endif
 					retval = serial_upload(command_argv[1], NULL);
 			} else if (command_argc == 3) {
 #ifdef HAVE_USB_SUPPORT
-				if (mode == USB_MODE)
+				if (mode != SERIAL_MODE)
 					retval = USB_upload(command_argv[1], command_argv[2]);
 				else
 #endif
@@ -689,10 +900,18 @@ int main(int argc, char **argv)
 				printf("usage: put <source> [target]\n");
 				continue;
 			}
-			if (retval != -1)
+			if (retval != -1) {
 				printf("upload successful\n");
-			else
+				if (stat(command_argv[1], &st) == 0) {
+					xferlog("put", command_argv[1],
+						st.st_size,
+						get_mono_usec() - start);
+					metrics_file(1, st.st_size,
+						get_mono_usec() - start);
+				}
+			} else {
 				printf("upload error\n");
+			}
 		}
 
 		else
@@ -755,12 +974,32 @@ int command_parser(char *buffer, char *commandargs[], int argmax)
 void safe_exit(int exitcode)
 {
 	struct stat buf;
-	if (mode == SERIAL_MODE)
-		serial_send_switch_off();
+
+	/* -F: the last files checked and freed while the camera is there */
+	if (exitcode == 0 && opt_free) {
+		out_commit(1);
+		hook_wait();
+		free_run();
+	}
+	/* -W: nothing to close if the camera never came back */
+	if (mode == SERIAL_MODE && !camera_lost) {
+		if (opt_keep_pcmode)
+			serial_suspend();
+		else
+			serial_send_switch_off();
+	}
 #ifdef HAVE_USB_SUPPORT
-	else
+	else if (mode != SERIAL_MODE)
 		USB_close();
 #endif
+	sink_finish();
+	out_commit(1);
+	hook_wait();
+	journal_close();
+	xferlog_close();
+	metrics_export(1);
+	if (exitcode != 0 && trace_dump(trace_file) == 0)
+		printf("protocol trace in %s\n", trace_file);
 	if (lstat(TEMP_FILE_NAME, &buf) != -1) {
 		if (!S_ISLNK(buf.st_mode))
 			unlink(TEMP_FILE_NAME);
@@ -786,11 +1025,14 @@ void show_help(void)
 "help param               show help on parameters",
 "help custom              show help on custom values",
 "open                     open the camera",
-"reopen                   close and open the camera",
+"reopen                   close and open the camera (resuming, see -k)",
 "close                    close the connection with the camera",
 "speed         [speed]    change the serial speed",
+"governor      [on|off]   serial link governor on/off, stats without args",
+"pace          [n] [usec] A50 writer: n bytes per write, usec idle per byte",
 "quit                     close the camera and quit the program",
 "ping                     ping four times the camera",
+"linkbench     [file [repeats [chunk ...]]] command RTT and download rate",
 "clear                    clear the screen under some terminal types",
 "id                       show the camera id",
 "date                     show the internal date of the camera",
@@ -799,10 +1041,11 @@ void show_help(void)
 "diskinfo      <disk>     show disk information",
 "ls | cd | dir <dir>      change to and list the specified directory",
 "lastls                   show the last cached directory listing",
-"get           <pathname> get the specified image",
-"getall                   get all the files in the current directory",
-"getallold                get all the old files in the current directory",
-"getallnew                get all the new files in the current directory",
+"get           <pathname> [dest...] get the specified image",
+"getall        [dest...]  get all the files in the current directory",
+"getallold     [dest...]  get all the old files in the current directory",
+"getallnew     [dest...]  get all the new files in the current directory",
+"                         dest: directories, - for stdout or FIFOs",
 "tget          <pathname> get the specified image as thumbnail",
 "view          <pathname> view the thumbnail using xv",
 "viewall                  view all thumbnails in the current directory",
@@ -813,6 +1056,10 @@ void show_help(void)
 "mkdir         <dirname>  create a directory",
 "rmdir         <dirname>  remove a directory",
 "debug         (DEBUG)    turn the debug on/off",
+"stats         [reset]    transfer counters and latency histograms",
+"trace         [n|hex]    show the last protocol events, 20 by default",
+"trace dump    [file]     dump the event ring, decode it with s10trace",
+"trace clear              empty the event ring",
 "getpkt        (DEBUG)    wait for a packet from the camera",
 "test <num>    (DEBUG)    send the specified request and wait for data",
 "rm | delete   <filename> remove a file in the current path",
@@ -867,16 +1114,32 @@ int byteswap32(int val)
 	return val;
 }
 
+/* A listing of the batch functions. -W: again once the camera is back
+ * if it was lost, in the same directory. */
+static void batch_list(char *path)
+{
+	while(camera_get_list(path) == -1) {
+		if (!camera_recover()) {
+			printf("Error listing %s\n", path);
+			exit(1);
+		}
+	}
+}
+
 void do_cli_getall(int which)
 {
-	int j, c;
+	int j, c, files = 0;
+	unsigned long long bytes = 0;
 	char *directory[1024];
 
-	if (camera_get_list(dcimpath) == -1) {
-		printf("Error listing %s\n", dcimpath);
-		exit(1);
+	/* -J: the files left by the last run, no listing */
+	if (journal_file && journal_resume()) {
+		journal_run();
+		return;
 	}
 
+	batch_list(dcimpath);
+
 	if (dirlist_size == 0) {
 		printf("CF seems empty\n");
 		exit(0);
@@ -896,25 +1159,37 @@ void do_cli_getall(int which)
 	}
 	directory[c] = NULL;
 
+	/* a first pass for the size of the whole batch */
+	mydisplay = 0;
+	for (c = 0; directory[c]; c++) {
+		batch_list(directory[c]);
+		files += camera_last_ls_size(which, &bytes);
+		if (journal_file)
+			journal_plan(which);
+		batch_list("..");
+	}
+	mydisplay = 1;
+	if (journal_file) {
+		journal_ready();
+		journal_run();
+		return;
+	}
+	progress_batch_begin(files, bytes);
+
 	c = 0;
 	while(directory[c]) {
 		printf("---> %s\n", directory[c]);
-		if (camera_get_list(directory[c]) == -1) {
-			printf("Error listing %s\n", directory[c]);
-			exit(1);
-		}
+		batch_list(directory[c]);
 		if (dirlist_size == 0) {
                     printf("skipping empty directory\n");
 		} else if (camera_get_last_ls(which) == -1) {
 			printf("camera_get_last_ls error\n");
 			exit(1);
 		}
-		if (camera_get_list("..") == -1) {
-			printf("Error performing cd ..\n");
-			exit(1);
-		}
+		batch_list("..");
 		c++;
 	}
+	progress_batch_end();
 }
 
 void do_cli_listall(void)
@@ -922,10 +1197,7 @@ void do_cli_listall(void)
 	int j, c;
 	char *directory[1024];
 
-	if (camera_get_list(dcimpath) == -1) {
-		printf("Error listing %s\n", dcimpath);
-		exit(1);
-	}
+	batch_list(dcimpath);
 
 	if (dirlist_size == 0) {
 		printf("CF seems empty\n");
@@ -949,14 +1221,8 @@ void do_cli_listall(void)
 	c = 0;
 	while(directory[c]) {
 		printf("---> %s\n", directory[c]);
-		if (camera_get_list(directory[c]) == -1) {
-			printf("Error listing %s\n", directory[c]);
-			exit(1);
-		}
-		if (camera_get_list("..") == -1) {
-			printf("Error performing cd ..\n");
-			exit(1);
-		}
+		batch_list(directory[c]);
+		batch_list("..");
 		c++;
 	}
 }
@@ -971,10 +1237,7 @@ void do_cli_deleteall(void)
 	if (getchar() != 'y')
 		exit(0);
 
-	if (camera_get_list(dcimpath) == -1) {
-		printf("Error listing %s\n", dcimpath);
-		exit(1);
-	}
+	batch_list(dcimpath);
 
 	if (dirlist_size == 0) {
 		printf("CF seems empty\n");
@@ -998,32 +1261,27 @@ void do_cli_deleteall(void)
 	c = 0;
 	while(directory[c]) {
 		printf("---> %s\n", directory[c]);
-		if (camera_get_list(directory[c]) == -1) {
-			printf("Error listing %s\n", directory[c]);
-			exit(1);
-		}
-		if (camera_delete_all(WHICH_ALL) == -1) {
-			printf("camera_delete_all error\n");
-			exit(1);
-		}
-		if (camera_get_list("..") == -1) {
-			printf("Error performing cd ..\n");
-			exit(1);
+		batch_list(directory[c]);
+		while(camera_delete_all(WHICH_ALL) == -1) {
+			if (!camera_recover()) {
+				printf("camera_delete_all error\n");
+				exit(1);
+			}
+			/* what is left of the folder */
+			batch_list(lastpath);
 		}
+		batch_list("..");
 #ifdef HAVE_USB_SUPPORT
-		if (mode == USB_MODE)
+		if (mode != SERIAL_MODE)
 			USB_rmdir(directory[c]);
 		else
 #endif
 			serial_rmdir(directory[c]);
 		c++;
 	}
-	if (camera_get_list("..") == -1) {
-		printf("Error performing cd ..\n");
-		exit(1);
-	}
+	batch_list("..");
 #ifdef HAVE_USB_SUPPORT
-	if (mode == USB_MODE)
+	if (mode != SERIAL_MODE)
 		USB_rmdir("DCIM");
 	else
 #endif
@@ -1035,7 +1293,13 @@ void show_usage(void)
   printf(
          "s10sh -- Canon Digital Camera Software\n"
          "Version %s\n\n"
-         "usage: s10sh -[DaugnlELhctZS] [-d <serialdevice> -i <value> -s <speed>]\n\n"
+         "usage: s10sh -[DaugnlELhctZSGk] [-d <serialdevice> -i <value> -s <speed>]\n"
+         "             [-r <trace> | -R <trace>] [-V <spec>] [-X <logfile>]\n"
+         "             [-B <tracefile>] [-M <metricsfile>] [-P <output>]\n"
+         "             [-o <dest>] [-b <bytes>] [-T <tarfile>]\n"
+         "             [-f <count>[:<ms>]] [-H <manifest>]\n"
+         "             [-N <template>] [-x <command> [-j <jobs>]] [-F]\n"
+         "             [-J <journal>] [-W <seconds>]\n\n"
          "  -D                    enable debug mode\n"
 #if __FreeBSD__
          "  -d <serialdevice>     set the serial device, default /dev/cuaa0\n"
@@ -1044,8 +1308,28 @@ void show_usage(void)
 #endif
          "  -a                    enable A50/Pro70 compatibility mode\n"
          "  -s <serialspeed>      set the serial speed (9600 19200 38400 57600 115200)\n"
+         "  -G                    serial link governor, lower/raise the speed as needed\n"
+         "  -k                    keep the camera in PC mode at exit, resume next time\n"
          "  -u                    USB mode, now default; use -S for SERIAL\n"
 	 "  -S                    SERIAL mode, default is now USB mode\n"
+         "  -r <tracefile>        record the USB session in a trace file\n"
+         "  -R <tracefile>        replay a recorded USB session, no camera needed\n"
+         "  -V <spec>             virtual camera, e.g. folders=200,files=500,size=2M\n"
+         "  -X <logfile>          log bytes and time of every file transfer\n"
+         "  -B <tracefile>        dump the protocol events here on SIGUSR1 and errors\n"
+         "  -M <metricsfile>      export the metrics, JSON if *.json, else Prometheus\n"
+         "  -P <output>           write (default), pwrite or mmap: preallocated files\n"
+         "  -o <dest>             copy every download there: directory, - or FIFO\n"
+         "  -b <bytes>            backlog of a slow - or FIFO before waiting (8M)\n"
+         "  -T <tarfile>          downloads in a tar stream, - for stdout, not on disk\n"
+         "  -f <count>[:<ms>]     fsync the files in groups of count or every ms (1000)\n"
+         "  -H <manifest>         append the SHA-256 of every download, sha256sum format\n"
+         "  -N <template>         name of the downloads, e.g. {date:%%Y/%%m/%%d}/{seq}.{ext}\n"
+         "  -x <command>          run by sh for every downloaded file, path in $1\n"
+         "  -j <jobs>             -x commands at the same time (2)\n"
+         "  -F                    delete the downloads from the card once safe on disk\n"
+         "  -J <journal>          -g and -n continue where a stopped run left\n"
+         "  -W <seconds>          wait this long for a camera that went away\n"
          "  -g                    non-interactive mode, get all images\n"
          "  -n                    non-interactive mode, get all new images\n"
          "  -l                    non-interactive mode, list all images\n"
@@ -0,0 +1,273 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Transfer metrics: counters and log2 histograms of the command round
+ * trip, the file transfers, the disk writes, the remote captures and
+ * the hooks, on the monotonic clock.
+ * Shown by 'stats', exported with -M as JSON (a .json file) or in the
+ * Prometheus text format (any other name).
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "s10sh.h"
+
+struct histogram {
+	unsigned long long count, sum, min, max;
+	unsigned long long bucket[MET_BUCKETS];
+};
+
+static char *counter_name[MET_COUNTERS] = {
+	"commands", "retransmits", "timeouts", "crc_errors",
+	"transfer_errors", "files_get", "files_put", "bytes_get",
+	"bytes_put", "verify_errors", "refetches", "hooks", "hook_errors",
+	"files_freed", "reconnects"
+};
+
+/* name, unit in the exports, divisor from the recorded unit */
+static struct {
+	char *name;
+	char *unit;
+	double scale;
+} histogram_info[MET_HISTOGRAMS] = {
+	{ "command_rtt",	"seconds",	1e6 },
+	{ "file_transfer",	"seconds",	1e6 },
+	{ "file_rate",		"bytes_per_second", 1 },
+	{ "disk_write",		"seconds",	1e6 },
+	{ "capture",		"seconds",	1e6 },
+	{ "group_commit",	"seconds",	1e6 },
+	{ "hook",		"seconds",	1e6 },
+	{ "hook_wait",		"seconds",	1e6 },
+	{ "hook_queue",		"jobs",		1 },
+};
+
+static unsigned long long counters[MET_COUNTERS];
+static struct histogram histograms[MET_HISTOGRAMS];
+static unsigned long long cmd_start = 0;
+static unsigned long long metrics_start = 0;
+static char *export_file = NULL;
+static unsigned long long export_last = 0;
+
+void metrics_count(int counter, unsigned long long n)
+{
+	counters[counter] += n;
+}
+
+void metrics_observe(int histogram, unsigned long long value)
+{
+	struct histogram *h = &histograms[histogram];
+	int b = 0;
+
+	while(b < MET_BUCKETS-1 && value >= (1ULL << b))
+		b++;
+	h->bucket[b]++;
+	if (h->count == 0 || value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+	h->count++;
+	h->sum += value;
+}
+
+/* a request is out, the next reply closes the round trip */
+void metrics_cmd_start(void)
+{
+	cmd_start = get_mono_usec();
+	counters[MET_COMMANDS]++;
+}
+
+void metrics_cmd_reply(void)
+{
+	if (cmd_start == 0)
+		return;
+	metrics_observe(MET_CMD_RTT, get_mono_usec() - cmd_start);
+	cmd_start = 0;
+}
+
+void metrics_file(int put, unsigned long long bytes, unsigned long long usec)
+{
+	counters[put ? MET_FILES_PUT : MET_FILES_GET]++;
+	counters[put ? MET_BYTES_PUT : MET_BYTES_GET] += bytes;
+	metrics_observe(MET_FILE_TIME, usec);
+	metrics_observe(MET_FILE_RATE, bytes * 1000000 / (usec ? usec : 1));
+	metrics_export(0);
+}
+
+void metrics_reset(void)
+{
+	memset(counters, 0, sizeof(counters));
+	memset(histograms, 0, sizeof(histograms));
+	cmd_start = 0;
+	metrics_start = get_mono_usec();
+}
+
+/* the q quantile, linear inside the log2 bucket */
+static double quantile(struct histogram *h, double q)
+{
+	unsigned long long seen = 0, rank;
+	double lo, hi;
+	int b;
+
+	if (h->count == 0)
+		return 0;
+	rank = (unsigned long long)(q * h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	for (b = 0; b < MET_BUCKETS; b++) {
+		if (seen + h->bucket[b] >= rank)
+			break;
+		seen += h->bucket[b];
+	}
+	if (b == MET_BUCKETS)
+		return h->max;
+	lo = b ? (double)(1ULL << (b-1)) : 0;
+	hi = (double)(1ULL << b);
+	if (lo < h->min)
+		lo = h->min;
+	if (hi > h->max)
+		hi = h->max;
+	return lo + (hi - lo) * (rank - seen) / h->bucket[b];
+}
+
+void metrics_show(void)
+{
+	struct histogram *h;
+	int j;
+
+	printf("uptime %.1f s\n", (get_mono_usec() - metrics_start) / 1e6);
+	for (j = 0; j < MET_COUNTERS; j++)
+		printf("%-16s %llu\n", counter_name[j], counters[j]);
+	printf("\n%-14s %8s %11s %11s %11s %11s %11s\n", "", "count", "min",
+		"p50", "p90", "p99", "max");
+	for (j = 0; j < MET_HISTOGRAMS; j++) {
+		h = &histograms[j];
+		if (j == MET_FILE_RATE)
+			printf("%-14s %8llu %9.1fk %9.1fk %9.1fk %9.1fk "
+				"%9.1fk  bytes/s\n", histogram_info[j].name,
+				h->count, h->min/1024.0,
+				quantile(h, 0.5)/1024, quantile(h, 0.9)/1024,
+				quantile(h, 0.99)/1024, h->max/1024.0);
+		else if (j == MET_HOOK_QUEUE)
+			printf("%-14s %8llu %11llu %11.1f %11.1f %11.1f "
+				"%11llu  jobs\n", histogram_info[j].name,
+				h->count, h->min, quantile(h, 0.5),
+				quantile(h, 0.9), quantile(h, 0.99), h->max);
+		else
+			printf("%-14s %8llu %11.3f %11.3f %11.3f %11.3f "
+				"%11.3f  ms\n", histogram_info[j].name,
+				h->count, h->min/1000.0,
+				quantile(h, 0.5)/1000, quantile(h, 0.9)/1000,
+				quantile(h, 0.99)/1000, h->max/1000.0);
+	}
+}
+
+static void export_prometheus(FILE *fp)
+{
+	struct histogram *h;
+	unsigned long long cum;
+	double scale;
+	int j, b, last;
+
+	for (j = 0; j < MET_COUNTERS; j++)
+		fprintf(fp, "# TYPE s10sh_%s_total counter\n"
+			"s10sh_%s_total %llu\n", counter_name[j],
+			counter_name[j], counters[j]);
+	for (j = 0; j < MET_HISTOGRAMS; j++) {
+		h = &histograms[j];
+		scale = histogram_info[j].scale;
+		fprintf(fp, "# TYPE s10sh_%s_%s histogram\n",
+			histogram_info[j].name, histogram_info[j].unit);
+		/* up to the bucket of the max, the rest is +Inf */
+		for (last = MET_BUCKETS-1; last > 0 && !h->bucket[last]; last--)
+			;
+		cum = 0;
+		for (b = 0; b <= last; b++) {
+			cum += h->bucket[b];
+			fprintf(fp, "s10sh_%s_%s_bucket{le=\"%g\"} %llu\n",
+				histogram_info[j].name, histogram_info[j].unit,
+				(double)(1ULL << b) / scale, cum);
+		}
+		fprintf(fp, "s10sh_%s_%s_bucket{le=\"+Inf\"} %llu\n"
+			"s10sh_%s_%s_sum %g\n"
+			"s10sh_%s_%s_count %llu\n",
+			histogram_info[j].name, histogram_info[j].unit,
+			h->count,
+			histogram_info[j].name, histogram_info[j].unit,
+			h->sum / scale,
+			histogram_info[j].name, histogram_info[j].unit,
+			h->count);
+	}
+}
+
+static void export_json(FILE *fp)
+{
+	struct histogram *h;
+	int j, b, n;
+
+	fprintf(fp, "{\n  \"uptime_usec\": %llu,\n  \"counters\": {",
+		get_mono_usec() - metrics_start);
+	for (j = 0; j < MET_COUNTERS; j++)
+		fprintf(fp, "%s\n    \"%s\": %llu", j ? "," : "",
+			counter_name[j], counters[j]);
+	fprintf(fp, "\n  },\n  \"histograms\": {");
+	for (j = 0; j < MET_HISTOGRAMS; j++) {
+		h = &histograms[j];
+		fprintf(fp, "%s\n    \"%s\": {\"unit\": \"%s\", "
+			"\"count\": %llu, \"sum\": %llu, \"min\": %llu, "
+			"\"max\": %llu, \"p50\": %.0f, \"p90\": %.0f, "
+			"\"p99\": %.0f,\n      \"buckets\": [",
+			j ? "," : "", histogram_info[j].name,
+			j == MET_FILE_RATE ? "bytes/s" :
+			j == MET_HOOK_QUEUE ? "jobs" : "usec",
+			h->count, h->sum, h->min, h->max, quantile(h, 0.5),
+			quantile(h, 0.9), quantile(h, 0.99));
+		/* [upper bound, count] of the non empty buckets */
+		for (b = n = 0; b < MET_BUCKETS; b++)
+			if (h->bucket[b])
+				fprintf(fp, "%s[%llu, %llu]", n++ ? ", " : "",
+					1ULL << b, h->bucket[b]);
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "\n  }\n}\n");
+}
+
+int metrics_export_open(char *filename)
+{
+	export_file = filename;
+	return 0;
+}
+
+/* Write the -M file, at most every MET_EXPORT_USEC unless forced. The
+ * file is replaced by a rename, a scraper never reads half of it. */
+void metrics_export(int force)
+{
+	char tmp[1024];
+	unsigned long long now;
+	int len;
+	FILE *fp;
+
+	if (!export_file)
+		return;
+	now = get_mono_usec();
+	if (!force && now - export_last < MET_EXPORT_USEC)
+		return;
+	export_last = now;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", export_file);
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		perror("metrics export");
+		return;
+	}
+	len = strlen(export_file);
+	if (len > 5 && !strcmp(export_file+len-5, ".json"))
+		export_json(fp);
+	else
+		export_prometheus(fp);
+	if (fclose(fp) != 0 || rename(tmp, export_file) == -1)
+		perror("metrics export");
+}
@@ -0,0 +1,56 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_METRICS_H
+#define S10SH_METRICS_H
+
+/* counters */
+#define MET_COMMANDS		0	/* requests sent to the camera */
+#define MET_RETRANSMITS		1	/* serial retransmission requests */
+#define MET_TIMEOUTS		2	/* serial reads timed out */
+#define MET_CRC_ERRORS		3	/* serial frames with bad CRC */
+#define MET_XFER_ERRORS		4	/* failed USB transfers */
+#define MET_FILES_GET		5
+#define MET_FILES_PUT		6
+#define MET_BYTES_GET		7
+#define MET_BYTES_PUT		8
+#define MET_VERIFY_ERRORS	9	/* downloads that failed the checks */
+#define MET_REFETCHES		10	/* and were requested again */
+#define MET_HOOKS		11	/* -x hooks that ran */
+#define MET_HOOK_ERRORS		12	/* and failed or didn't start */
+#define MET_FREED		13	/* -F, deleted after the check */
+#define MET_RECONNECTS		14	/* -W, sessions opened again */
+#define MET_COUNTERS		15
+
+/* histograms, log2 buckets */
+#define MET_CMD_RTT		0	/* usec from a request to its reply */
+#define MET_FILE_TIME		1	/* usec to move a file */
+#define MET_FILE_RATE		2	/* bytes/s of a file */
+#define MET_DISK_WRITE		3	/* usec to write a file to the disk */
+#define MET_CAPTURE		4	/* usec from the release to the file */
+#define MET_COMMIT		5	/* usec of a -f group commit */
+#define MET_HOOK		6	/* usec a -x hook ran */
+#define MET_HOOK_WAIT		7	/* usec it waited in the queue */
+#define MET_HOOK_QUEUE		8	/* hooks queued or running, a new one in */
+#define MET_HISTOGRAMS		9
+
+#define MET_BUCKETS		40	/* bucket n holds values < 2^n */
+#define MET_EXPORT_USEC		1000000	/* -M file at most once a second */
+
+void metrics_count(int counter, unsigned long long n);
+void metrics_observe(int histogram, unsigned long long value);
+void metrics_cmd_start(void);
+void metrics_cmd_reply(void);
+void metrics_file(int put, unsigned long long bytes, unsigned long long usec);
+void metrics_show(void);
+void metrics_reset(void);
+int metrics_export_open(char *filename);
+void metrics_export(int force);
+
+#endif /* S10SH_METRICS_H */
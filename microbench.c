@@ -0,0 +1,335 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Microbenchmarks of the CPU side kernels: CRC, SHA-256, frame escaping and
+ * decoding, directory list decoding, thumbnail scan, parameter lookup.
+ * The inputs are synthetic and the same on every run.
+ *
+ * usage: microbench [-w warmup] [-r reps] [-t msec] [kernel ...]
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include "s10sh.h"
+#include "crc.h"
+#include "sha256.h"
+#include "param.h"
+
+/* the few globals of s10sh the kernels use */
+int opt_debug = 0;
+camera_type camera_model = DRebel;
+
+unsigned long long get_mono_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000000+tv.tv_usec;
+}
+
+static unsigned long long now_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (unsigned long long)ts.tv_sec*1000000000+ts.tv_nsec;
+#endif
+	return get_mono_usec()*1000;
+}
+
+#define BUF_MAX		(1024*1024)
+
+static unsigned char src[BUF_MAX+2];
+static unsigned char dst[BUF_MAX*2+2];
+static unsigned int seed = 1;
+static volatile unsigned long sink;	/* keeps the results alive */
+
+static unsigned char rnd8(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+static void fill(unsigned char *p, int len)
+{
+	int j;
+
+	seed = 1;
+	for (j = 0; j < len; j++)
+		p[j] = rnd8();
+}
+
+/* Every kernel runs iters times on an input of the given size and
+ * returns the units (bytes or operations) processed. */
+
+static unsigned long k_crc(int size, unsigned long iters)
+{
+	static int ready = 0;
+	static unsigned short crc;
+	unsigned long i;
+
+	if (ready != size) {
+		fill(src, size);
+		crc = canon_psa50_gen_crc((char*)src, size);
+		ready = size;
+	}
+	for (i = 0; i < iters; i++)
+		sink += canon_psa50_chk_crc((char*)src, size, crc);
+	return iters*size;
+}
+
+/* a download chunk into the running hash */
+static unsigned long k_sha256(int size, unsigned long iters)
+{
+	struct sha256 c;
+	unsigned char digest[SHA256_LEN];
+	unsigned long i;
+
+	fill(src, size);
+	sha256_init(&c);
+	for (i = 0; i < iters; i++)
+		sha256_update(&c, src, size);
+	sha256_final(&c, digest);
+	sink += digest[0];
+	return iters*size;
+}
+
+static unsigned long k_escape(int size, unsigned long iters)
+{
+	unsigned long i;
+
+	fill(src, size);
+	for (i = 0; i < iters; i++)
+		sink += sio_escape(dst, src, size);
+	return iters*size;
+}
+
+/* worst case, every byte needs the escape */
+static unsigned long k_escape_all(int size, unsigned long iters)
+{
+	unsigned long i;
+
+	memset(src, 0xC0, size);
+	for (i = 0; i < iters; i++)
+		sink += sio_escape(dst, src, size);
+	return iters*size;
+}
+
+/* the receive side of sio.c without the read(): ring, decode, queue */
+static unsigned long k_unescape(int size, unsigned long iters)
+{
+	static int port = -1;
+	unsigned long i;
+	int flen, len, fds[2];
+
+	if (port == -1) {
+		if (pipe(fds) == -1 || (port = sio_attach(fds[0])) == -1) {
+			perror("microbench: pipe");
+			exit(1);
+		}
+	}
+	fill(src, size);
+	flen = sio_escape(dst, src, size);
+	for (i = 0; i < iters; i++) {
+		sio_feed(port, dst, flen);
+		sink += *sio_get_frame(port, &len, 0);
+	}
+	return iters*size;
+}
+
+/* a listing of size entries like the camera sends */
+static unsigned long k_list(int size, unsigned long iters)
+{
+	static int ready = 0;
+	static unsigned char *end;
+	struct canonfile f;
+	unsigned char *p;
+	unsigned long i, n = 0;
+	int j;
+
+	if (ready != size) {
+		p = src;
+		fill(src, size*(LIST_ENTRY_MIN+12));
+		for (j = 0; j < size; j++) {
+			p[0] = 0x20;
+			p[1] = 0;
+			p += 10;
+			p += sprintf((char*)p, "IMG_%04d.JPG", j+1) + 1;
+		}
+		memset(p, 0, LIST_ENTRY_MIN);
+		end = p + LIST_ENTRY_MIN;
+		ready = size;
+	}
+	for (i = 0; i < iters; i++) {
+		p = src;
+		while(parse_list_entry(&p, end, &f) == 1)
+			n++;
+	}
+	sink += n;
+	return n;
+}
+
+/* JPEG like data (every FF is followed by 00) with a thumbnail from
+ * the middle to the end */
+static unsigned long k_thumb(int size, unsigned long iters)
+{
+	static int ready = 0;
+	unsigned char *start;
+	unsigned long i;
+	int j;
+
+	if (ready != size) {
+		fill(src, size);
+		for (j = 0; j < size-1; j++)
+			if (src[j] == 0xFF)
+				src[++j] = 0x00;
+		src[0] = 0xFF; src[1] = 0xD8;
+		src[size/2] = 0xFF; src[size/2+1] = 0xD8;
+		src[size-2] = 0xFF; src[size-1] = 0xD9;
+		ready = size;
+	}
+	for (i = 0; i < iters; i++)
+		sink += parse_thumb(src, size, &start);
+	return iters*size;
+}
+
+static unsigned long k_param(char *name, unsigned long iters)
+{
+	char *value;
+	unsigned long i;
+
+	memset(src, 0, 0x100);
+	for (i = 0; i < iters; i++)
+		sink += get_param_value(name, &value, (char*)src);
+	return iters;
+}
+
+static unsigned long k_param_first(int size, unsigned long iters)
+{
+	return k_param("ISO", iters);
+}
+
+static unsigned long k_param_last(int size, unsigned long iters)
+{
+	return k_param("Metering", iters);
+}
+
+static unsigned long k_param_missing(int size, unsigned long iters)
+{
+	return k_param("NoSuchParam", iters);
+}
+
+static struct kernel {
+	char *name;
+	char *unit;
+	unsigned long (*run)(int size, unsigned long iters);
+	int sizes[4];		/* 0 terminated */
+} kernels[] = {
+	{ "crc",		"byte",  k_crc,		{ 16, 256, 1020 } },
+	{ "sha256",		"byte",  k_sha256,	{ 64, 4096, 65536 } },
+	{ "escape",		"byte",  k_escape,	{ 64, 1024, 4096 } },
+	{ "escape-all",		"byte",  k_escape_all,	{ 1024 } },
+	{ "unescape",		"byte",  k_unescape,	{ 64, 1024, 4000 } },
+	{ "list",		"entry", k_list,	{ 10, 100, 1000 } },
+	{ "thumb",		"byte",  k_thumb,	{ 10813, 65536, BUF_MAX } },
+	{ "param-first",	"op",	 k_param_first,	{ 1 } },
+	{ "param-last",		"op",	 k_param_last,	{ 1 } },
+	{ "param-missing",	"op",	 k_param_missing, { 1 } },
+	{ NULL }
+};
+
+static int opt_warmup = 2;
+static int opt_reps = 7;
+static unsigned long long opt_rep_ns = 20000000;	/* 20 ms */
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(double*)a, y = *(double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static void measure(struct kernel *k, int size)
+{
+	unsigned long iters = 1, units = 0;
+	unsigned long long t;
+	double ns[64];
+	int r;
+
+	/* grow iters until one repetition takes the -t time */
+	while(1) {
+		t = now_ns();
+		k->run(size, iters);
+		t = now_ns() - t;
+		if (t >= opt_rep_ns || iters >= (1UL << 40))
+			break;
+		iters *= (t < opt_rep_ns/100) ? 10 : 2;
+	}
+	for (r = 0; r < opt_warmup; r++)
+		k->run(size, iters);
+	for (r = 0; r < opt_reps; r++) {
+		t = now_ns();
+		units = k->run(size, iters);
+		t = now_ns() - t;
+		ns[r] = (double)t / (units ? units : 1);
+	}
+	qsort(ns, opt_reps, sizeof(double), cmp_double);
+	printf("%-14s %8d %12lu %10.3f %10.3f   ns/%s\n", k->name, size,
+		iters, ns[0], ns[opt_reps/2], k->unit);
+}
+
+int main(int argc, char **argv)
+{
+	struct kernel *k;
+	int c, j, a;
+
+	while ((c = getopt(argc, argv, "w:r:t:h")) != EOF) {
+		switch(c) {
+		case 'w':
+			opt_warmup = atoi(optarg);
+			break;
+		case 'r':
+			opt_reps = atoi(optarg);
+			if (opt_reps < 1 || opt_reps > 64) {
+				printf("1 to 64 repetitions\n");
+				exit(1);
+			}
+			break;
+		case 't':
+			opt_rep_ns = strtoull(optarg, NULL, 10) * 1000000;
+			break;
+		default:
+			printf("usage: microbench [-w warmup] [-r reps] "
+				"[-t msec per rep] [kernel ...]\nkernels:");
+			for (k = kernels; k->name; k++)
+				printf(" %s", k->name);
+			printf("\n");
+			exit(1);
+		}
+	}
+
+	printf("%-14s %8s %12s %10s %10s\n", "kernel", "size", "iters",
+		"best", "median");
+	for (k = kernels; k->name; k++) {
+		if (optind < argc) {
+			for (a = optind; a < argc; a++)
+				if (!strcmp(argv[a], k->name))
+					break;
+			if (a == argc)
+				continue;
+		}
+		for (j = 0; j < 4 && k->sizes[j]; j++)
+			measure(k, k->sizes[j]);
+	}
+	return 0;
+}
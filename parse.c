@@ -0,0 +1,77 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Decoders of the data the camera sends, the same for SERIAL and USB.
+ * No I/O and no globals here, see also microbench.c.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <string.h>
+#include "s10sh.h"
+
+static unsigned int le32(unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/* Decode the directory entry at *p and move *p to the next one.
+ * Returns 1 for an entry, 0 at the end of the list (an entry with an
+ * empty name, or the end of the data), -1 if the name is truncated.
+ * The date is the camera one, GMT. */
+int parse_list_entry(unsigned char **p, unsigned char *end,
+	struct canonfile *f)
+{
+	unsigned char *e = *p, *nul;
+	int len;
+
+	if (end - e < LIST_ENTRY_MIN || !e[10])
+		return 0;
+	nul = memchr(e+10, '\0', end-e-10);
+	if (!nul)
+		return -1;
+	len = nul - (e+10);
+	if (len >= (int)sizeof(f->name))
+		len = sizeof(f->name)-1;
+	f->type = e[0];
+	f->size = le32(e+2);
+	f->date = le32(e+6);
+	memcpy(f->name, e+10, len);
+	f->name[len] = '\0';
+	*p = nul+1;
+	return 1;
+}
+
+/* The thumbnail is a JPEG inside the image data: the second FFD8 up
+ * to the next FFD9. Returns its length and start, -1 if not found. */
+int parse_thumb(unsigned char *image, int len, unsigned char **start)
+{
+	unsigned char *t, *end = image+len-1, *s;
+
+	if (len < 4)
+		return -1;
+	/* skip the first FFD8 */
+	for (t = image+2; t < end; t++) {
+		t = memchr(t, 0xFF, end-t);
+		if (!t)
+			return -1;
+		if (t[1] == 0xD8)
+			break;
+	}
+	if (t >= end)
+		return -1;
+	s = t;
+	for (t = s+2; t < end; t++) {
+		t = memchr(t, 0xFF, end-t);
+		if (!t)
+			return -1;
+		if (t[1] == 0xD9) {
+			*start = s;
+			return t+2-s;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,19 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_PARSE_H
+#define S10SH_PARSE_H
+
+#define LIST_ENTRY_MIN	11	/* attr, 0, size, date, name\0 */
+
+int parse_list_entry(unsigned char **p, unsigned char *end,
+	struct canonfile *f);
+int parse_thumb(unsigned char *image, int len, unsigned char **start);
+
+#endif /* S10SH_PARSE_H */
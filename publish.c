@@ -0,0 +1,419 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Atomic publish of the downloaded files. A file is written without a
+ * name (O_TMPFILE) or under a hidden temporary one in the same
+ * directory, and linked or renamed to its real name only when it is
+ * complete: a crash or a failed transfer never leaves a truncated
+ * image under the name of the real one.
+ *
+ * With -f count[:ms] the files are also made durable, a group at a
+ * time: the complete files wait until count of them are there or the
+ * first one waited ms, then all of them are fsync()ed, published, and
+ * their directories fsync()ed once. A crash loses the group in
+ * progress, never the data of a file that has a name.
+ *
+ * With -H every downloaded file gets a line in a manifest, in the
+ * format of sha256sum: 'sha256sum -c' checks the copies later.
+ *
+ * With -N the files land under a name made from a template, with the
+ * EXIF date and model found in the first chunk, so no pass over the
+ * files is needed afterwards to sort them. The directories are made
+ * when the first file needs them, once.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* O_TMPFILE */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "s10sh.h"
+
+int commit_count = 0;		/* files per group commit, 0 no fsync */
+unsigned long commit_ms = COMMIT_MS;
+FILE *manifest = NULL;		/* -H */
+char *name_template = NULL;	/* -N */
+unsigned long commit_done = 0;	/* group commits so far */
+
+static struct {
+	int fd;
+	char tmp[1024];
+	char path[1024];
+} pending[COMMIT_MAX];
+static int npending = 0;
+static unsigned long long pending_since;
+
+/* the directories made or found by out_mkdirs(), the latest ones */
+static char dirs_known[DIRS_KNOWN][1024];
+static int dirs_next = 0;
+
+/* the directory of path, "." if none */
+static void dir_of(char *path, char *dir, int size)
+{
+	char *p = strrchr(path, '/');
+
+	if (p == NULL)
+		snprintf(dir, size, ".");
+	else if (p == path)
+		snprintf(dir, size, "/");
+	else
+		snprintf(dir, size, "%.*s", (int)(p-path), path);
+}
+
+/* Open the file that will become path. tmp gets its temporary name,
+ * empty if it has none. */
+int out_open(char *path, char *tmp)
+{
+	static mode_t mode = 0;
+	char dir[1024];
+	char *base;
+	int fd;
+
+	if (!mode) {
+		mode = umask(0);
+		umask(mode);
+		mode = 0644 & ~mode;
+	}
+	dir_of(path, dir, sizeof(dir));
+	tmp[0] = '\0';
+#ifdef O_TMPFILE
+	fd = open(dir, O_TMPFILE|O_RDWR, 0644);
+	if (fd != -1)
+		return fd;
+#endif
+	base = strrchr(path, '/');
+	base = base ? base+1 : path;
+	if (snprintf(tmp, 1024, "%s/.%s.XXXXXX", dir, base) >= 1024) {
+		printf("%s: name too long\n", path);
+		tmp[0] = '\0';
+		return -1;
+	}
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		perror(tmp);
+		tmp[0] = '\0';
+		return -1;
+	}
+	fchmod(fd, mode);
+	journal_tmp(tmp);
+	return fd;
+}
+
+void out_discard(int fd, char *tmp)
+{
+	close(fd);
+	if (tmp[0])
+		unlink(tmp);
+}
+
+/* The name appears, replacing an old file only with overwrite on. */
+static int publish(int fd, char *tmp, char *path)
+{
+	char proc[64];
+
+	if (!tmp[0]) {
+		snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+		if (!opt_overwrite)
+			return linkat(AT_FDCWD, proc, AT_FDCWD, path,
+				AT_SYMLINK_FOLLOW);
+		/* linkat() doesn't replace, a name to rename first */
+		snprintf(tmp, 1024, "%s.%d.tmp", path, (int)getpid());
+		unlink(tmp);
+		if (linkat(AT_FDCWD, proc, AT_FDCWD, tmp,
+		    AT_SYMLINK_FOLLOW) == -1) {
+			tmp[0] = '\0';
+			return -1;
+		}
+	}
+	if (opt_overwrite)
+		return rename(tmp, path);
+	if (link(tmp, path) == -1)
+		return -1;
+	unlink(tmp);
+	tmp[0] = '\0';
+	return 0;
+}
+
+/* The file is complete: its date, then its name now, or in the next
+ * group commit with -f. -1 if it has no name, even from the commit. */
+int out_publish(int fd, char *tmp, char *path, time_t mtime)
+{
+	struct timeval tval[2];
+	int n;
+
+	if (mtime) {
+		tval[0].tv_sec = tval[1].tv_sec = mtime;
+		tval[0].tv_usec = tval[1].tv_usec = 0;
+		futimes(fd, tval);
+	}
+	if (commit_count) {
+		if (npending == 0)
+			pending_since = get_mono_usec();
+		n = npending++;
+		pending[n].fd = fd;
+		snprintf(pending[n].tmp, 1024, "%s", tmp);
+		snprintf(pending[n].path, 1024, "%s", path);
+		out_commit(0);
+		/* a commit that failed this file left it without a path */
+		return (npending || pending[n].path[0]) ? 0 : -1;
+	}
+	if (publish(fd, tmp, path) == -1) {
+		perror(path);
+		out_discard(fd, tmp);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+/* A file of the group not durable or without its name: it is thrown
+ * away, and not done for the journal, the hooks and -F. */
+static void pending_lost(int j)
+{
+	perror(pending[j].path);
+	out_discard(pending[j].fd, pending[j].tmp);
+	journal_lost(pending[j].path);
+	hook_lost(pending[j].path);
+	pending[j].path[0] = '\0';
+}
+
+/* Data first, then the names, then the directories that hold them. */
+void out_commit(int force)
+{
+	unsigned long long start = get_mono_usec();
+	char dir[1024], other[1024];
+	int j, k, fd;
+
+	if (npending == 0)
+		return;
+	if (!force && npending < commit_count && npending < COMMIT_MAX &&
+	    start - pending_since < commit_ms * 1000ULL)
+		return;
+	for (j = 0; j < npending; j++)
+		if (fsync(pending[j].fd) == -1)
+			pending_lost(j);
+	for (j = 0; j < npending; j++) {
+		if (!pending[j].path[0])
+			continue;
+		if (publish(pending[j].fd, pending[j].tmp,
+		    pending[j].path) == -1) {
+			pending_lost(j);
+			continue;
+		}
+		close(pending[j].fd);
+	}
+	for (j = 0; j < npending; j++) {
+		if (!pending[j].path[0])
+			continue;
+		dir_of(pending[j].path, dir, sizeof(dir));
+		for (k = 0; k < j; k++) {
+			dir_of(pending[k].path, other, sizeof(other));
+			if (pending[k].path[0] && !strcmp(dir, other))
+				break;
+		}
+		if (k < j)
+			continue;
+		fd = open(dir, O_RDONLY);
+		if (fd == -1 || fsync(fd) == -1)
+			perror(dir);
+		if (fd != -1)
+			close(fd);
+	}
+	npending = 0;
+	commit_done++;
+	journal_commit();
+	metrics_observe(MET_COMMIT, get_mono_usec() - start);
+}
+
+/* files waiting for the next group commit */
+int out_pending(void)
+{
+	return npending;
+}
+
+/* -f count[:ms] */
+int out_commit_policy(char *spec)
+{
+	char *p;
+
+	commit_count = strtoul(spec, &p, 10);
+	if (*p == ':')
+		commit_ms = strtoul(p+1, &p, 10);
+	if (*p != '\0' || commit_count < 1 || commit_count > COMMIT_MAX) {
+		printf("-f wants count[:ms], count from 1 to %d\n",
+			COMMIT_MAX);
+		return -1;
+	}
+	return 0;
+}
+
+/* -H, the lines are appended to what is there */
+int manifest_open(char *path)
+{
+	manifest = fopen(path, "a");
+	if (manifest == NULL) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* out on every line, a crash doesn't lose the hashes of the files
+ * already there */
+void manifest_add(char *hex, char *path)
+{
+	if (manifest == NULL)
+		return;
+	fprintf(manifest, "%s  %s\n", hex, path);
+	if (fflush(manifest) == EOF)
+		perror("manifest");
+}
+
+/* s for a path component: letters, digits, . - and _, the rest _ */
+static int clean(char *out, int size, char *s)
+{
+	int n = 0;
+
+	for (; *s && n < size-1; s++)
+		out[n++] = (isalnum((unsigned char)*s) || strchr(".-_", *s)) ?
+			*s : '_';
+	out[n] = '\0';
+	return n;
+}
+
+/* The -N template for the camera file name in folder: {date} and
+ * {date:<strftime format>} from the EXIF date, else the listing one,
+ * {body} the camera model, {name} and {ext} of the file name, {seq}
+ * its number, {folder}. */
+int out_name(char *out, int size, char *tmpl, char *name, char *folder,
+	struct exif *e, time_t listed)
+{
+	char field[256], value[1024], *arg, *p, *ext;
+	time_t date = e->date ? e->date : listed;
+	struct tm *tm;
+	int n = 0, len;
+
+	ext = strrchr(name, '.');
+	if (!ext)
+		ext = name+strlen(name);
+	while(*tmpl && n < size-1) {
+		if (*tmpl != '{') {
+			out[n++] = *tmpl++;
+			continue;
+		}
+		p = strchr(tmpl, '}');
+		if (!p || p-tmpl-1 >= (int)sizeof(field)) {
+			printf("-N: no } after %s\n", tmpl);
+			return -1;
+		}
+		snprintf(field, sizeof(field), "%.*s", (int)(p-tmpl-1), tmpl+1);
+		tmpl = p+1;
+		arg = strchr(field, ':');
+		if (arg)
+			*arg++ = '\0';
+		value[0] = '\0';
+		if (!strcmp(field, "date")) {
+			tm = localtime(&date);
+			if (!tm || !strftime(value, sizeof(value),
+			    arg ? arg : "%Y%m%d_%H%M%S", tm))
+				value[0] = '\0';
+			/* the format may have slashes, the value is as is */
+			len = snprintf(out+n, size-n, "%s", value);
+			n += (len < size-n) ? len : size-n-1;
+			continue;
+		} else if (!strcmp(field, "body")) {
+			snprintf(value, sizeof(value), "%s",
+				e->model[0] ? e->model :
+				cameraid[0] ? cameraid : "unknown");
+		} else if (!strcmp(field, "name")) {
+			snprintf(value, sizeof(value), "%.*s",
+				(int)(ext-name), name);
+		} else if (!strcmp(field, "ext")) {
+			snprintf(value, sizeof(value), "%s",
+				*ext ? ext+1 : "");
+		} else if (!strcmp(field, "seq")) {
+			for (p = ext; p > name && isdigit((unsigned char)p[-1]);
+			     p--)
+				;
+			snprintf(value, sizeof(value), "%.*s",
+				(int)(ext-p), p);
+		} else if (!strcmp(field, "folder")) {
+			snprintf(value, sizeof(value), "%s", folder);
+		} else {
+			printf("-N: unknown field {%s}\n", field);
+			return -1;
+		}
+		n += clean(out+n, size-n, value);
+	}
+	out[n] = '\0';
+	if (n == 0 || out[n-1] == '/') {
+		printf("-N: '%s' makes no file name\n", out);
+		return -1;
+	}
+	return 0;
+}
+
+/* -N, tried on a file name to see it works */
+int out_template(char *tmpl)
+{
+	struct exif e;
+	char name[1024];
+
+	memset(&e, 0, sizeof(e));
+	if (out_name(name, sizeof(name), tmpl, "IMG_0001.JPG", "100CANON",
+	    &e, time(NULL)) == -1)
+		return -1;
+	name_template = tmpl;
+	return 0;
+}
+
+/* The directories up to the one of path. A directory made or found
+ * once is not looked at again: a getall into a few dated directories
+ * makes them with the first file of each. With -f a new directory is
+ * synced in its parent. */
+int out_mkdirs(char *path)
+{
+	char dir[1024], parent[1024], *p;
+	int j, c, fd;
+
+	dir_of(path, dir, sizeof(dir));
+	for (j = 0; j < DIRS_KNOWN; j++)
+		if (!strcmp(dirs_known[j], dir))
+			return 0;
+	for (p = dir+1; ; p++) {
+		if (*p != '/' && *p != '\0')
+			continue;
+		c = *p;
+		*p = '\0';
+		if (mkdir(dir, 0777) == 0) {
+			if (commit_count) {
+				dir_of(dir, parent, sizeof(parent));
+				fd = open(parent, O_RDONLY);
+				if (fd == -1 || fsync(fd) == -1)
+					perror(parent);
+				if (fd != -1)
+					close(fd);
+			}
+		} else if (errno != EEXIST) {
+			perror(dir);
+			return -1;
+		}
+		*p = c;
+		if (c == '\0')
+			break;
+	}
+	snprintf(dirs_known[dirs_next++ % DIRS_KNOWN], 1024, "%s", dir);
+	return 0;
+}
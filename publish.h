@@ -0,0 +1,39 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_PUBLISH_H
+#define S10SH_PUBLISH_H
+
+#include <stdio.h>
+
+#define COMMIT_MAX	256	/* files held by a group commit, open fds */
+#define COMMIT_MS	1000	/* the default time threshold of -f */
+#define COMMIT_SAFE	8	/* -F and -J without -f, files per group */
+#define DIRS_KNOWN	16	/* directories out_mkdirs() remembers */
+
+extern int commit_count;
+extern unsigned long commit_ms;
+extern FILE *manifest;
+extern char *name_template;
+extern unsigned long commit_done;
+
+int out_open(char *path, char *tmp);
+void out_discard(int fd, char *tmp);
+int out_publish(int fd, char *tmp, char *path, time_t mtime);
+void out_commit(int force);
+int out_pending(void);
+int out_commit_policy(char *spec);
+int manifest_open(char *path);
+void manifest_add(char *hex, char *path);
+int out_name(char *out, int size, char *tmpl, char *name, char *folder,
+	struct exif *e, time_t listed);
+int out_template(char *tmpl);
+int out_mkdirs(char *path);
+
+#endif /* S10SH_PUBLISH_H */
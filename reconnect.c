@@ -0,0 +1,94 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * The reconnect supervisor of -W: a camera that goes off the bus (USB
+ * says no device) or out of PC mode (serial) no longer ends s10sh. The
+ * session is marked lost, every transfer fails at once so the command
+ * in progress gives up quickly, then the camera is looked for again,
+ * at first every RECONNECT_MIN_MS and then less and less often, up to
+ * -W seconds. Once it is back only the handshake is done again, the
+ * current directory is the one of before and the command that broke
+ * is tried again: a download from the start of the file, a listing
+ * as a whole. A camera that doesn't come back in time ends s10sh, as
+ * before -W, with the files already downloaded on the disk and the
+ * usual exit work done: the end of a tar stream, the hooks, the
+ * journal and the metrics.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "s10sh.h"
+
+int reconnect_secs = 0;		/* -W, 0: a lost camera ends s10sh */
+int camera_lost = 0;		/* the session is over */
+static int looking = 0;		/* in the reconnect loop */
+
+/* from the transports, the camera is not there anymore */
+void camera_gone(void)
+{
+	if (camera_lost)
+		return;
+	camera_lost = 1;
+	/* a reopen that fails, the camera is not back yet */
+	if (looking)
+		return;
+	trace_event(TR_MARK, 0, 0, "camera gone", 11, get_mono_usec());
+	printf("\n===WARNING===> the camera is gone\n");
+}
+
+/* Wait for the camera and open a new session with it. Returns 0 when
+ * it is back, exits if it doesn't come back in -W seconds. */
+int camera_reconnect(void)
+{
+	char saved[1024];
+	unsigned long long start = get_mono_usec(), deadline;
+	unsigned long delay = RECONNECT_MIN_MS;
+	int tries = 0;
+
+	if (!reconnect_secs)
+		return -1;
+	snprintf(saved, sizeof(saved), "%s", lastpath);
+	deadline = start + reconnect_secs * 1000000ULL;
+	/* what is complete goes on the disk, whatever happens next */
+	out_commit(1);
+	printf("waiting up to %d seconds for the camera\n", reconnect_secs);
+	fflush(stdout);
+	looking = 1;
+	while(1) {
+		camera_lost = 0;
+		tries++;
+		if (camera_reopen() == 0)
+			break;
+		camera_lost = 1;
+		if (get_mono_usec() + delay*1000ULL > deadline) {
+			printf("the camera didn't come back in %d seconds\n",
+				reconnect_secs);
+			safe_exit(1);
+		}
+		usleep(delay*1000);
+		delay *= 2;
+		if (delay > RECONNECT_MAX_MS)
+			delay = RECONNECT_MAX_MS;
+	}
+	looking = 0;
+	snprintf(lastpath, sizeof(lastpath), "%s", saved);
+	metrics_count(MET_RECONNECTS, 1);
+	printf("the camera is back after %.1f seconds, %d looks\n",
+		(get_mono_usec() - start) / 1e6, tries);
+	return 0;
+}
+
+/* After a failed command: 1 if it failed because the camera was lost
+ * and the camera is back, the command is to be done again. */
+int camera_recover(void)
+{
+	if (!camera_lost || !reconnect_secs)
+		return 0;
+	return camera_reconnect() == 0;
+}
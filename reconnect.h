@@ -0,0 +1,24 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_RECONNECT_H
+#define S10SH_RECONNECT_H
+
+#define RECONNECT_MIN_MS	100	/* first wait between two looks */
+#define RECONNECT_MAX_MS	2000	/* the wait doubles up to here */
+#define RECONNECT_RETRIES	5	/* for one file, then it fails */
+
+extern int reconnect_secs;
+extern int camera_lost;
+
+void camera_gone(void);
+int camera_reconnect(void);
+int camera_recover(void);
+
+#endif /* S10SH_RECONNECT_H */
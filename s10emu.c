@@ -0,0 +1,954 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * s10emu: a serial PowerShot on a pseudo terminal. It answers the UUUU
+ * sync, the speed switch, and the messages of msgtype_list[] using a
+ * directory as the flash card, so the serial driver can be tested and
+ * timed without a camera: s10sh -S -d /dev/pts/N
+ *
+ * The line speed is emulated by pacing both directions, and bit errors
+ * can be injected to exercise the retransmissions.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/statvfs.h>
+#include "crc.h"
+
+#define EMU_FRAME_MAX	1024	/* wire size limit of a frame */
+#define EMU_MSG_MAX	65536
+#define EMU_DATA_CHUNK	7680	/* file data per download message */
+#define EMU_THUMB_SIZE	10813	/* what a S10 sends for a thumbnail */
+#define EMU_ACK_MSEC	1000	/* wait for the host ACK */
+#define EMU_TRIES	10	/* sends of a message before giving up */
+
+#define PKT_MSG		0x00
+#define PKT_OFF		0x02
+#define PKT_SPEED	0x03
+#define PKT_EOT		0x04
+#define PKT_ACK		0x05
+#define PKT_INIT	0x06
+
+#define ST_OK		0x00000000
+#define ST_NOFILE	0x02000022
+#define ST_NODIR	0x02000040
+#define ST_NODISK	0x02000087
+
+static int mfd, sfd;		/* pty master, slave kept open */
+static int opt_debug = 0;
+static int speed = 9600;	/* negotiated speed */
+static int cap_bps = 0;		/* -b, emulated line rate, 0 = speed */
+static double ber = 0;		/* -e, bit error rate */
+static char *camname = "Canon PowerShot S10";
+static char owner[32] = "s10emu";
+static char card[1024];		/* the flash card directory */
+static int card_tmp = 0;	/* created by us, removed at exit */
+static long date_offset = 0;	/* set date - host time */
+
+static int pcmode = 0;
+static unsigned char cam_seq = 0; /* our EOTs, the host ack_sequence */
+static int pending_speed = 0;
+static unsigned char msg[EMU_MSG_MAX];
+static int msglen = 0, msg_bad = 0;
+
+static unsigned long long line_out = 0, line_in = 0; /* line busy until */
+static unsigned char inbuf[4096];
+static int inlen = 0, inpos = 0;
+static volatile sig_atomic_t emu_stop = 0; /* SIGINT/SIGTERM, print stats */
+
+static struct {
+	unsigned long long bytes_in, bytes_out;
+	unsigned long frames_in, frames_out, crc_in, corrupt_in, corrupt_out;
+	unsigned long ack_errors, eot_resends, syncs;
+	unsigned long long start;
+} st;
+
+static struct emu_attr {
+	char path[1024];
+	unsigned char attr;
+	struct emu_attr *next;
+} *attrs = NULL;
+
+static unsigned long long emu_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000ULL + ts.tv_nsec/1000;
+}
+
+static void emu_sleep_until(unsigned long long t)
+{
+	unsigned long long now = emu_usec();
+
+	if (t > now)
+		usleep(t-now);
+}
+
+static unsigned long long emu_char_usec(void)
+{
+	int bps = (cap_bps && cap_bps < speed) ? cap_bps : speed;
+
+	return 10000000ULL/bps; /* 8N1 */
+}
+
+/* flip one bit of the byte with the probability of a bit error in it */
+static unsigned char emu_noise(unsigned char c, unsigned long *count)
+{
+	static double pbyte = -1;
+
+	if (ber <= 0)
+		return c;
+	if (pbyte < 0) {
+		double ok = 1;
+		int j;
+
+		for (j = 0; j < 8; j++)
+			ok *= 1-ber;
+		pbyte = 1-ok;
+	}
+	if (drand48() < pbyte) {
+		(*count)++;
+		c ^= 1 << (lrand48() & 7);
+	}
+	return c;
+}
+
+/* write at the emulated line rate, in small chunks */
+static void emu_write(unsigned char *buf, int len)
+{
+	unsigned char chunk[32];
+	unsigned long long now;
+	int n, j, w;
+
+	while(len) {
+		n = len < 32 ? len : 32;
+		for (j = 0; j < n; j++)
+			chunk[j] = emu_noise(buf[j], &st.corrupt_out);
+		emu_sleep_until(line_out);
+		now = emu_usec();
+		if (line_out < now)
+			line_out = now;
+		for (j = 0; j < n; j += w) {
+			w = write(mfd, chunk+j, n-j);
+			if (w == -1) {
+				if (errno == EINTR || errno == EAGAIN) {
+					w = 0;
+					usleep(1000);
+					continue;
+				}
+				perror("write");
+				exit(1);
+			}
+		}
+		line_out += n*emu_char_usec();
+		st.bytes_out += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+/* next received byte, -1 after msec without data */
+static int emu_getc(int msec)
+{
+	fd_set rfds;
+	struct timeval tv;
+	unsigned long long now;
+	int n;
+
+	if (inpos == inlen) {
+		FD_ZERO(&rfds);
+		FD_SET(mfd, &rfds);
+		tv.tv_sec = msec/1000;
+		tv.tv_usec = (msec%1000)*1000;
+		n = select(mfd+1, &rfds, NULL, NULL, msec < 0 ? NULL : &tv);
+		if (n <= 0)
+			return -1;
+		n = read(mfd, inbuf, sizeof(inbuf));
+		if (n <= 0) {
+			/* EIO: nobody has the slave open, can't happen as
+			 * we keep it, but don't spin if it does */
+			usleep(100000);
+			return -1;
+		}
+		inlen = n;
+		inpos = 0;
+		st.bytes_in += n;
+		/* the bytes take their time on the line too */
+		now = emu_usec();
+		if (line_in < now)
+			line_in = now;
+		line_in += n*emu_char_usec();
+	}
+	return emu_noise(inbuf[inpos++], &st.corrupt_in);
+}
+
+/* Read a frame, unescaped, CRC included. Returns its length, 0 if the
+ * host started a new sync with UUUU, -1 on timeout. */
+static int emu_get_frame(unsigned char *frame, int msec)
+{
+	int c, len = 0, ucount = 0;
+
+	while((c = emu_getc(msec)) != 0xC0) {
+		if (c == -1)
+			return -1;
+		if (c == 'U' && ++ucount == 4)
+			return 0;
+		if (c != 'U')
+			ucount = 0;
+	}
+	while((c = emu_getc(msec)) != 0xC1) {
+		if (c == -1)
+			return -1;
+		if (c == 0xC0) { /* lost the end */
+			len = 0;
+			continue;
+		}
+		/* out of PC mode a sync wins over a broken frame */
+		if (!pcmode && c == 'U' && ++ucount == 4)
+			return 0;
+		if (c != 'U')
+			ucount = 0;
+		if (c == 0x7E) {
+			if ((c = emu_getc(msec)) == -1)
+				return -1;
+			c ^= 0x20;
+		}
+		if (len == EMU_MSG_MAX)
+			return -1;
+		frame[len++] = c;
+	}
+	emu_sleep_until(line_in);
+	st.frames_in++;
+	/* the switch off frame has no CRC init value for its length */
+	if (len == 4 && frame[1] == PKT_OFF)
+		return len;
+	if (len < 4 || !canon_psa50_chk_crc((char*)frame, len-2,
+	    frame[len-2] | (frame[len-1] << 8))) {
+		st.crc_in++;
+		if (opt_debug)
+			printf("bad frame, %d bytes\n", len);
+		frame[1] = 0xFF; /* no valid type */
+	}
+	return len;
+}
+
+static void emu_send_frame(unsigned char *data, int len)
+{
+	unsigned char buffer[EMU_MSG_MAX*2+8];
+	unsigned short cksum;
+	int index = 0, j;
+
+	cksum = canon_psa50_gen_crc((char*)data, len);
+	buffer[index++] = 0xC0;
+	for (j = 0; j < len+2; j++) {
+		unsigned char c;
+
+		if (j < len)
+			c = data[j];
+		else if (j == len)
+			c = cksum & 0xff;
+		else
+			c = cksum >> 8;
+		if (c == 0x7E || c == 0xC0 || c == 0xC1) {
+			buffer[index++] = 0x7E;
+			c ^= 0x20;
+		}
+		buffer[index++] = c;
+	}
+	buffer[index++] = 0xC1;
+	emu_write(buffer, index);
+	st.frames_out++;
+}
+
+static void emu_send_packet(unsigned char seq, unsigned char type,
+	unsigned char *data, int len)
+{
+	unsigned char buffer[EMU_FRAME_MAX+4];
+
+	buffer[0] = seq;
+	buffer[1] = type;
+	buffer[2] = len & 0xff;
+	buffer[3] = len >> 8;
+	memcpy(buffer+4, data, len);
+	emu_send_frame(buffer, len+4);
+}
+
+static void emu_send_short(unsigned char seq, unsigned char type,
+	unsigned char arg)
+{
+	unsigned char buffer[6];
+
+	memset(buffer, 0, 6);
+	buffer[0] = seq;
+	buffer[1] = type;
+	buffer[2] = arg;
+	emu_send_frame(buffer, 6);
+}
+
+/* message bytes that fit one frame of EMU_FRAME_MAX once escaped */
+static int emu_frag_fit(unsigned char *m, int len)
+{
+	int room = EMU_FRAME_MAX - 2 - (4+2)*2;
+	int n = 0;
+
+	while(n < len) {
+		room -= (m[n] == 0x7E || m[n] == 0xC0 || m[n] == 0xC1) ? 2 : 1;
+		if (room < 0)
+			break;
+		n++;
+	}
+	return n;
+}
+
+/* Send a message as fragments closed by an EOT and wait for the ACK,
+ * resending what the host asks for. Returns 0 once acknowledged. */
+static int emu_send_message(unsigned char *m, int len)
+{
+	int off[256];
+	int nfrags = 0, j, first = 0, tries, flen, err;
+	unsigned char frame[EMU_MSG_MAX];
+
+	for (j = 0; j < len && nfrags < 255; j += emu_frag_fit(m+j, len-j))
+		off[nfrags++] = j;
+	off[nfrags] = len;
+
+	for (tries = 0; tries < EMU_TRIES; tries++) {
+		for (j = first; j < nfrags; j++)
+			emu_send_packet(j, PKT_MSG, m+off[j], off[j+1]-off[j]);
+		emu_send_short(cam_seq, PKT_EOT,
+			nfrags >= 8 ? 0xFF : (1 << nfrags) - 1);
+		first = nfrags; /* only the EOT, unless asked */
+
+		flen = emu_get_frame(frame, EMU_ACK_MSEC);
+		if (flen <= 0 || frame[1] != PKT_ACK) {
+			st.eot_resends++;
+			continue;
+		}
+		err = frame[2];
+		if (err == 0) {
+			cam_seq++;
+			return 0;
+		}
+		st.ack_errors++;
+		first = (err >= 1 && err <= nfrags) ? err-1 : 0;
+	}
+	printf("no ACK from the host, message dropped\n");
+	return -1;
+}
+
+static void put32(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+static unsigned int get32(unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/* the response header and status, the request serial number echoed */
+static int emu_resp_begin(unsigned char *r, unsigned int status)
+{
+	memcpy(r, msg, 16);
+	r[7] = (msg[7] == 0x12) ? 0x22 : 0x21;
+	put32(r+16, status);
+	return 20;
+}
+
+static int emu_resp_send(unsigned char *r, int len)
+{
+	r[8] = len & 0xff;
+	r[9] = len >> 8;
+	return emu_send_message(r, len);
+}
+
+/* Map a camera path (D:\DCIM\100CANON) on the card directory, matching
+ * names without case. Returns 0 if it exists, 1 if only the last
+ * component is missing, -1 otherwise. */
+static int emu_path(char *campath, char *out, int size)
+{
+	char buf[1024], *p, *comp;
+	struct dirent *de;
+	struct stat sb;
+	DIR *dir;
+	int missing = 0;
+
+	strncpy(buf, campath, 1023);
+	buf[1023] = '\0';
+	p = buf;
+	if (p[0] && p[1] == ':')
+		p += 2;
+	snprintf(out, size, "%s", card);
+	for (comp = strtok(p, "\\/"); comp; comp = strtok(NULL, "\\/")) {
+		if (missing)
+			return -1;
+		if (!strcmp(comp, "."))
+			continue;
+		if (!strcmp(comp, "..")) {
+			char *slash = strrchr(out, '/');
+
+			if (slash && strlen(out) > strlen(card))
+				*slash = '\0';
+			continue;
+		}
+		missing = 1;
+		if ((dir = opendir(out)) != NULL) {
+			while((de = readdir(dir)) != NULL) {
+				if (!strcasecmp(de->d_name, comp)) {
+					comp = de->d_name;
+					missing = 0;
+					break;
+				}
+			}
+			snprintf(out+strlen(out), size-strlen(out), "/%s",
+				comp);
+			closedir(dir);
+		} else {
+			return -1;
+		}
+	}
+	if (missing)
+		return 1;
+	return stat(out, &sb) == 0 ? 0 : -1;
+}
+
+static struct emu_attr *emu_attr_find(char *path)
+{
+	struct emu_attr *a;
+
+	for (a = attrs; a; a = a->next)
+		if (!strcmp(a->path, path))
+			return a;
+	return NULL;
+}
+
+/* files are new (not downloaded) until the host says otherwise */
+static unsigned char emu_attr(char *path, int isdir)
+{
+	struct emu_attr *a = emu_attr_find(path);
+
+	if (a)
+		return a->attr;
+	return isdir ? 0x10 : 0x20;
+}
+
+static void emu_list(unsigned char *r, int len)
+{
+	char path[1024], full[2048];
+	unsigned char *p;
+	struct dirent *de;
+	struct stat sb;
+	DIR *dir;
+	char *name = (char*)msg+17;
+
+	if (emu_path(name, path, 1024) != 0 || (dir = opendir(path)) == NULL) {
+		len = emu_resp_begin(r, ST_NODIR);
+		memset(r+len, 0, 8);
+		r[len] = 0x01;
+		emu_resp_send(r, len+8);
+		return;
+	}
+	p = r+len;
+	*p++ = 0x01;	/* last message */
+	*p++ = 0x80;
+	memset(p, 0, 9);
+	p += 9;
+	strcpy((char*)p, name);
+	p += strlen(name)+1;
+	while((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(full, 2048, "%s/%s", path, de->d_name);
+		if (stat(full, &sb) == -1)
+			continue;
+		if (p+11+strlen(de->d_name)+1 > r+EMU_MSG_MAX-16)
+			break;
+		*p++ = emu_attr(full, S_ISDIR(sb.st_mode));
+		*p++ = 0;
+		put32(p, S_ISDIR(sb.st_mode) ? 0 : sb.st_size);
+		put32(p+4, sb.st_mtime);
+		p += 8;
+		strcpy((char*)p, de->d_name);
+		p += strlen(de->d_name)+1;
+	}
+	closedir(dir);
+	memset(p, 0, 11); /* all zero entry */
+	p += 11;
+	emu_resp_send(r, p-r);
+}
+
+static void emu_download(unsigned char *r)
+{
+	char path[1024];
+	unsigned char *data;
+	struct stat sb;
+	int fd, len, offset, n, thumb = msg[16];
+
+	fd = -1;
+	if (emu_path((char*)msg+24, path, 1024) == 0)
+		fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &sb) == -1 || S_ISDIR(sb.st_mode)) {
+		if (fd != -1)
+			close(fd);
+		len = emu_resp_begin(r, ST_NOFILE);
+		memset(r+len, 0, 16);
+		r[len+12] = 0x01;
+		emu_resp_send(r, len+16);
+		return;
+	}
+	len = sb.st_size;
+	if (thumb && len > EMU_THUMB_SIZE)
+		len = EMU_THUMB_SIZE;
+	for (offset = 0; offset < len; offset += n) {
+		n = len-offset;
+		if (n > EMU_DATA_CHUNK)
+			n = EMU_DATA_CHUNK;
+		emu_resp_begin(r, ST_OK);
+		put32(r+20, len);
+		put32(r+24, offset);
+		put32(r+28, n);
+		put32(r+32, offset+n == len);
+		data = r+36;
+		if (pread(fd, data, n, offset) != n) {
+			perror("pread");
+			break;
+		}
+		if (emu_resp_send(r, 36+n) == -1)
+			break;
+	}
+	close(fd);
+}
+
+static void emu_upload(unsigned char *r)
+{
+	char path[1024], *name = (char*)msg+28;
+	unsigned int offset = get32(msg+20), len = get32(msg+24);
+	unsigned int status = ST_OK, header = 29;
+	int fd;
+
+	/* the name and the data must be inside the message */
+	if (msglen > 28)
+		header = 28+strnlen(name, msglen-28)+1;
+	if (header > (unsigned int)msglen || len > msglen-header) {
+		status = ST_NODISK;
+	} else if (emu_path(name, path, 1024) == -1 ||
+	    (fd = open(path, O_WRONLY|O_CREAT, 0644)) == -1) {
+		status = ST_NODIR;
+	} else {
+		if (pwrite(fd, name+strlen(name)+1, len, offset) != (int)len)
+			status = ST_NODISK;
+		close(fd);
+	}
+	emu_resp_send(r, emu_resp_begin(r, status));
+}
+
+/* simple commands with a path argument and a status reply */
+static void emu_path_cmd(unsigned char *r, char *name, int op)
+{
+	char path[1024];
+	unsigned int status = ST_OK;
+	int exists = emu_path(name, path, 1024);
+
+	switch(op) {
+	case 0x05: /* mkdir */
+		if (exists != 1 || mkdir(path, 0755) == -1)
+			status = ST_NODIR;
+		break;
+	case 0x06: /* rmdir */
+		if (exists != 0 || rmdir(path) == -1)
+			status = ST_NODIR;
+		break;
+	case 0x0d: /* delete */
+		if (exists != 0 || unlink(path) == -1)
+			status = ST_NOFILE;
+		break;
+	case 0x0e: /* set attributes, the attribute comes first */
+		if (exists != 0) {
+			status = ST_NOFILE;
+		} else {
+			struct emu_attr *a = emu_attr_find(path);
+
+			if (!a) {
+				a = malloc(sizeof(struct emu_attr));
+				if (!a) {
+					printf("out of memory\n");
+					exit(1);
+				}
+				strcpy(a->path, path);
+				a->next = attrs;
+				attrs = a;
+			}
+			a->attr = msg[16];
+		}
+		break;
+	}
+	emu_resp_send(r, emu_resp_begin(r, status));
+}
+
+static void emu_command(void)
+{
+	static unsigned char r[EMU_MSG_MAX];
+	unsigned char mtype = msg[4], dir = msg[7];
+	struct statvfs sv;
+	unsigned long long total, avail;
+	int len, j;
+
+	if (opt_debug)
+		printf("message %02x/%02x, %d bytes\n", mtype, dir, msglen);
+	len = emu_resp_begin(r, ST_OK);
+	switch((mtype << 8) | dir) {
+	case 0x0112: /* identify */
+		memset(r+20, 0, 72);
+		r[21] = 0x04;
+		put32(r+24, 0x01000001);
+		strncpy((char*)r+28, camname, 31);
+		memcpy(r+60, owner, sizeof(owner));
+		emu_resp_send(r, 92);
+		break;
+	case 0x0111: /* download */
+		emu_download(r);
+		break;
+	case 0x0a11: /* flash device */
+		memset(r+20, 0, 4);
+		strcpy((char*)r+20, "D:");
+		emu_resp_send(r, 24);
+		break;
+	case 0x0911: /* disk info */
+		total = avail = 0;
+		if (statvfs(card, &sv) == 0) {
+			total = (unsigned long long)sv.f_blocks*sv.f_frsize;
+			avail = (unsigned long long)sv.f_bavail*sv.f_frsize;
+		}
+		put32(r+20, total > 0x7fffffff ? 0x7fffffff : total);
+		put32(r+24, avail > 0x7fffffff ? 0x7fffffff : avail);
+		emu_resp_send(r, 28);
+		break;
+	case 0x0a12: /* power status: good, AC adapter */
+		memset(r+20, 0, 4);
+		r[20] = 0x06;
+		r[23] = 0x10;
+		emu_resp_send(r, 24);
+		break;
+	case 0x0312: /* get date */
+		memset(r+20, 0, 12);
+		put32(r+20, time(NULL)+date_offset);
+		emu_resp_send(r, 32);
+		break;
+	case 0x0412: /* set date */
+		date_offset = (long)get32(msg+16) - time(NULL);
+		emu_resp_send(r, len);
+		break;
+	case 0x0512: /* owner */
+		for (j = 0; j < 31 && msg[16+j]; j++)
+			owner[j] = msg[16+j];
+		owner[j] = '\0';
+		emu_resp_send(r, len);
+		break;
+	case 0x0b11: /* list */
+		emu_list(r, len);
+		break;
+	case 0x0311: /* upload */
+		emu_upload(r);
+		break;
+	case 0x0511: /* mkdir */
+	case 0x0611: /* rmdir */
+	case 0x0d11: /* delete */
+		emu_path_cmd(r, (char*)msg+16, mtype);
+		break;
+	case 0x0e11: /* set attributes */
+		emu_path_cmd(r, (char*)msg+20, mtype);
+		break;
+	default:
+		printf("unknown message %02x/%02x\n", mtype, dir);
+		emu_resp_send(r, emu_resp_begin(r, ST_NODISK));
+		break;
+	}
+}
+
+/* the host sent UUUU: send our ID and wait for the ACK */
+static void emu_sync(void)
+{
+	unsigned char init[64], frame[EMU_MSG_MAX];
+	unsigned long long deadline;
+	int len;
+
+	speed = 9600;
+	pcmode = 0;
+	cam_seq = 0;
+	msglen = 0;
+	pending_speed = 0;
+	/* the host sends more UUUU while waiting, give it a moment */
+	usleep(20000);
+	tcflush(mfd, TCIFLUSH);
+	inpos = inlen = 0;
+	memset(init, 0, 64);
+	strncpy((char*)init+22, camname, 31);
+	emu_send_packet(0, PKT_INIT, init, 64);
+	emu_send_short(cam_seq, PKT_EOT, 0x01);
+	/* UUUU sent while we were answering are not a new sync */
+	deadline = emu_usec() + EMU_ACK_MSEC*1000ULL;
+	while(emu_usec() < deadline) {
+		len = emu_get_frame(frame, EMU_ACK_MSEC);
+		if (len > 0 && frame[1] == PKT_ACK) {
+			cam_seq++;
+			pcmode = 1;
+			st.syncs++;
+			printf("host synced\n");
+			return;
+		}
+	}
+}
+
+static void emu_frame(unsigned char *frame, int len)
+{
+	int flen;
+
+	switch(frame[1]) {
+	case PKT_MSG:
+		if (frame[0] == 0)
+			msglen = msg_bad = 0;
+		flen = frame[2] | (frame[3] << 8);
+		if (flen != len-6 || msglen+flen > EMU_MSG_MAX) {
+			msg_bad = 1;
+			break;
+		}
+		memcpy(msg+msglen, frame+4, flen);
+		msglen += flen;
+		break;
+	case PKT_OFF:
+		printf("host switched the camera off\n");
+		pcmode = 0;
+		speed = 9600;
+		break;
+	case PKT_SPEED:
+		pending_speed = frame[2];
+		break;
+	case PKT_EOT:
+		if (msglen && (msg_bad || msglen < 16 ||
+		    msglen != (msg[8] | (msg[9] << 8)))) {
+			emu_send_short(frame[0], PKT_ACK, 0xFF);
+			msg_bad = 0;
+			break;
+		}
+		emu_send_short(frame[0], PKT_ACK, 0);
+		if (pending_speed) {
+			emu_sleep_until(line_out); /* ACK out at old speed */
+			switch(pending_speed) {
+			case 0x02: speed = 9600; break;
+			case 0x08: speed = 19200; break;
+			case 0x20: speed = 38400; break;
+			case 0x40: speed = 57600; break;
+			default: speed = 115200; break;
+			}
+			printf("speed %d\n", speed);
+			pending_speed = 0;
+			break;
+		}
+		if (msglen) {
+			emu_command();
+			msglen = 0;
+		}
+		break;
+	default:
+		/* bad CRC or unexpected: spoil the message in progress */
+		msg_bad = 1;
+		break;
+	}
+}
+
+static int emu_rm(const char *path, const struct stat *sb, int flag,
+	struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static void emu_signal(int sig)
+{
+	emu_stop = 1;
+}
+
+static void emu_stats(void)
+{
+	unsigned long long usec = emu_usec()-st.start;
+
+	printf("\n%llu bytes in, %llu bytes out in %llu s, "
+		"%llu bytes/s out\n", st.bytes_in, st.bytes_out,
+		usec/1000000, usec ? st.bytes_out*1000000/usec : 0);
+	printf("%lu frames in (%lu bad CRC), %lu frames out, %lu syncs\n",
+		st.frames_in, st.crc_in, st.frames_out, st.syncs);
+	printf("%lu bytes corrupted in, %lu out, %lu ACK errors, "
+		"%lu EOT resent\n", st.corrupt_in, st.corrupt_out,
+		st.ack_errors, st.eot_resends);
+	if (card_tmp)
+		nftw(card, emu_rm, 16, FTW_DEPTH|FTW_PHYS);
+}
+
+/* a synthetic JPEG: EXIF segment with a thumbnail, then the image */
+static void emu_make_jpeg(char *path, int size, time_t date)
+{
+	struct timeval tv[2];
+	FILE *fp;
+	int j, thumb = 2000;
+
+	if (size < thumb+64)
+		size = thumb+64;
+	fp = fopen(path, "w");
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+	fwrite("\xFF\xD8\xFF\xE1", 4, 1, fp);
+	fputc((2+6+thumb+4) >> 8, fp);
+	fputc((2+6+thumb+4) & 0xff, fp);
+	fwrite("Exif\0\0\xFF\xD8", 8, 1, fp);
+	for (j = 0; j < thumb; j++)
+		fputc(lrand48() % 255, fp);
+	fwrite("\xFF\xD9", 2, 1, fp);
+	for (j = 16+thumb; j < size-2; j++)
+		fputc(lrand48() % 255, fp);
+	fwrite("\xFF\xD9", 2, 1, fp);
+	fclose(fp);
+	tv[0].tv_sec = tv[1].tv_sec = date;
+	tv[0].tv_usec = tv[1].tv_usec = 0;
+	utimes(path, tv);
+}
+
+static void emu_make_card(int images, int size)
+{
+	char path[1024];
+	int j;
+
+	strcpy(card, "/tmp/s10emu.XXXXXX");
+	if (mkdtemp(card) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	card_tmp = 1;
+	snprintf(path, 1024, "%s/DCIM", card);
+	mkdir(path, 0755);
+	snprintf(path, 1024, "%s/DCIM/100CANON", card);
+	mkdir(path, 0755);
+	for (j = 0; j < images; j++) {
+		snprintf(path, 1024, "%s/DCIM/100CANON/IMG_%04d.JPG",
+			card, j+1);
+		emu_make_jpeg(path, size, 946684800+j*60);
+	}
+}
+
+static void emu_usage(void)
+{
+	printf(
+	"usage: s10emu [-D] [-c <carddir>] [-n <images>] [-z <size>]\n"
+	"              [-b <bps>] [-e <ber>] [-r <seed>] [-N <name>]\n\n"
+	"  -D              debug\n"
+	"  -c <carddir>    use this directory as the flash card\n"
+	"  -n <images>     images on the synthetic card, default 8\n"
+	"  -z <size>       size of the synthetic images, default 200000\n"
+	"  -b <bps>        emulated line rate, default the negotiated speed\n"
+	"  -e <ber>        bit error rate on both directions, like 1e-5\n"
+	"  -r <seed>       random seed for the errors and the images\n"
+	"  -N <name>       camera name\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char frame[EMU_MSG_MAX];
+	struct termios t;
+	int c, len, images = 8, size = 200000;
+	long seed = 1;
+
+	while((c = getopt(argc, argv, "Dc:n:z:b:e:r:N:h")) != EOF) {
+		switch(c) {
+		case 'D':
+			opt_debug = 1;
+			break;
+		case 'c':
+			if (realpath(optarg, card) == NULL) {
+				perror(optarg);
+				exit(1);
+			}
+			break;
+		case 'n':
+			images = atoi(optarg);
+			break;
+		case 'z':
+			size = atoi(optarg);
+			break;
+		case 'b':
+			cap_bps = atoi(optarg);
+			break;
+		case 'e':
+			ber = atof(optarg);
+			break;
+		case 'r':
+			seed = atol(optarg);
+			break;
+		case 'N':
+			camname = optarg;
+			break;
+		default:
+			emu_usage();
+			exit(1);
+		}
+	}
+	srand48(seed);
+	if (!card[0])
+		emu_make_card(images, size);
+
+	mfd = posix_openpt(O_RDWR|O_NOCTTY);
+	if (mfd == -1 || grantpt(mfd) == -1 || unlockpt(mfd) == -1) {
+		perror("posix_openpt");
+		exit(1);
+	}
+	/* keep the slave open, or the master reads EIO between sessions */
+	sfd = open(ptsname(mfd), O_RDWR|O_NOCTTY);
+	if (sfd == -1 || tcgetattr(sfd, &t) == -1) {
+		perror(ptsname(mfd));
+		exit(1);
+	}
+	cfmakeraw(&t);
+	tcsetattr(sfd, TCSANOW, &t);
+
+	signal(SIGINT, emu_signal);
+	signal(SIGTERM, emu_signal);
+	st.start = emu_usec();
+	printf("s10emu: %s on %s, card %s\n", camname, ptsname(mfd), card);
+	fflush(stdout);
+
+	/* select() isn't restarted after a signal, we get here soon */
+	while(!emu_stop) {
+		len = emu_get_frame(frame, -1);
+		if (len == 0)
+			emu_sync();
+		else if (len > 0 && pcmode)
+			emu_frame(frame, len);
+		fflush(stdout);
+	}
+	emu_stats();
+	return 0;
+}
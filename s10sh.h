@@ -35,6 +35,7 @@
 /* driver modes */
 #define SERIAL_MODE	0
 #define USB_MODE	1
+#define VIRTUAL_MODE	2	/* USB protocol, vcam.c stands in for the camera */
 
 /* directory listing recursion types */
 #define DL_NO_RECURSION	0x00
@@ -52,9 +53,10 @@ struct canonfile {
 extern int opt_debug;
 extern int opt_overwrite;
 extern char prompt[1024];
-extern struct canonfile *dirlist[1024];
-extern int dirlist_size;
+extern struct canonfile **dirlist;
+extern int dirlist_size, dirlist_alloc;
 extern char lastpath[1024];
+extern char dcimpath[1024];
 extern char cameraid[1024];
 extern char firmware[8];
 extern int mode, mydisplay, DANGER;
@@ -62,12 +64,26 @@ extern int use_lowers;
 extern int GMT_offset;
 extern int user_init;
 
+#include "sha256.h"
+#include "exif.h"
+#include "xfer.h"
+#include "publish.h"
+#include "hook.h"
+#include "journal.h"
+#include "reconnect.h"
 #ifdef HAVE_USB_SUPPORT
 #include "usb.h"
 #endif
+#include "sio.h"
+#include "usbtrace.h"
+#include "trace.h"
+#include "metrics.h"
+#include "vcam.h"
+#include "parse.h"
 #include "serial.h"
 #include "common.h"
 #include "bar.h"
+#include "governor.h"
 
 /* main.c function prototypes */
 int command_parser(char *buffer, char *commandargs[], int argmax);
@@ -0,0 +1,96 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * s10trace, decoder of the protocol event dumps of s10sh (trace.c):
+ * one line per event and the time spent in every phase.
+ *
+ * usage: s10trace [-x] [-p] <dumpfile>
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "s10sh.h"
+
+/* trace.o wants the clock of common.c */
+unsigned long long get_mono_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000000+tv.tv_usec;
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_header h;
+	struct trace_event *ev;
+	int c, opt_hex = 0, opt_phases = 0;
+	FILE *fp;
+
+	while ((c = getopt(argc, argv, "xph")) != EOF) {
+		switch(c) {
+		case 'x':
+			opt_hex = 1;
+			break;
+		case 'p':
+			opt_phases = 1;
+			break;
+		default:
+			printf("usage: s10trace [-x] [-p] <dumpfile>\n"
+				"  -x  show the payload bytes kept\n"
+				"  -p  only the per phase summary\n");
+			exit(1);
+		}
+	}
+	if (optind != argc-1) {
+		printf("usage: s10trace [-x] [-p] <dumpfile>\n");
+		exit(1);
+	}
+
+	fp = fopen(argv[optind], "r");
+	if (fp == NULL) {
+		perror(argv[optind]);
+		exit(1);
+	}
+	if (fread(&h, sizeof(h), 1, fp) != 1 ||
+	    memcmp(h.magic, TRACE_MAGIC, 4)) {
+		printf("%s: not an s10sh trace\n", argv[optind]);
+		exit(1);
+	}
+	if (h.version != TRACE_VERSION ||
+	    h.evsize != sizeof(struct trace_event)) {
+		printf("%s: trace version %u, event size %u, expected %d and "
+			"%d\n", argv[optind], h.version, h.evsize,
+			TRACE_VERSION, (int)sizeof(struct trace_event));
+		exit(1);
+	}
+	ev = malloc(h.count ? h.count*h.evsize : 1);
+	if (ev == NULL) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	if (fread(ev, h.evsize, h.count, fp) != h.count) {
+		printf("%s: truncated\n", argv[optind]);
+		exit(1);
+	}
+	fclose(fp);
+
+	printf("%u events (%u before these lost), %u errors\n", h.count,
+		h.total - h.count, h.errors);
+	if (!opt_phases) {
+		printf("%12s %9s  %-9s value\n", "ms", "dur_ms", "event");
+		trace_print(stdout, ev, h.count, opt_hex);
+		printf("\n");
+	}
+	trace_phases(stdout, ev, h.count);
+	free(ev);
+	return 0;
+}
@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <termios.h>
@@ -21,13 +22,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
 #include "crc.h"		/* see crc.c, from gphoto's canon driver */
 #include "s10sh.h"
 
 int fd, pkt_sequence = 0;
+int serial_port = -1;			/* sio port of fd */
 unsigned char frag_sequence = 0;
-int serial_timeout = 1;
-int serial_u_timeout = 0;
 unsigned char eot_sequence = 0;
 unsigned char ack_sequence = 0;
 struct termios backup, new;
@@ -40,6 +42,11 @@ char *serialdev = "/dev/ttyS0";
 #endif
 
 int opt_a50 = 0; /* A50/Pro70 compatibility mode */
+int opt_keep_pcmode = 0; /* leave the camera in PC mode at exit */
+int serial_pace_chunk = 8;	/* A50 mode: bytes per write() */
+int serial_pace_gap = -1;	/* A50 mode: idle usec per byte, -1 measured */
+static unsigned long long pace_bytes = 0, pace_usec = 0;
+static int pace_measured = 0;	/* what a usleep(1) takes here */
 
 /* SERIAL COMMANDS STRINGS
    byte format: TDXXXX
@@ -74,6 +81,10 @@ unsigned char *msgtype_list[] =
 
 int serial_flush_input(void)
 {
+	if (serial_port != -1) {
+		sio_flush(serial_port);
+		return 0;
+	}
 	if (tcflush(fd,TCIFLUSH) < 0) {
 		perror("tcflush input");
 		return -1;
@@ -132,6 +143,11 @@ int serial_init(char *device)
 		return -1;
 	}
 
+	serial_port = sio_attach(fd);
+	if (serial_port == -1) {
+		close(fd);
+		return -1;
+	}
 	(void) serial_flush_input();
 	return 0;
 }
@@ -141,48 +157,177 @@ int serial_change_serial_speed(int speed)
 	cfsetospeed(&new, speed);
 	cfsetispeed(&new, speed);
 
-	if (tcsetattr(fd, TCSANOW, &new) == -1) {
+	/* the speed message must be out before the UART switches */
+	if (tcsetattr(fd, TCSADRAIN, &new) == -1) {
 		perror("tcsetattr");
 		return -1;
 	}
+	/* the A50 is slow to follow, the ping retries cover the rest */
 	if (opt_a50)
-		sleep(1);
+		usleep(SERIAL_A50_SETTLE);
 	return 0;
 }
 
-int serial_write(int fd, unsigned char *buffer, int size)
+/* map a speed in bps to the termios constant */
+int serial_speed_code(int speed)
+{
+	switch(speed) {
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+	default:
+		return B115200;
+	}
+}
+
+/* Change the link speed in the middle of a session, without a new
+ * sync: the same speed message used at startup followed by an EOT,
+ * then both sides switch and a ping checks the link. If the camera
+ * does not answer at the new speed we go back to the old one. */
+int serial_relink(int speed)
 {
-	int written = 0, i;
+	int old_speed = serial_speed;
+	unsigned char *pkt;
+	int len, retry;
 
-	if (opt_a50) {
-		unsigned char *aux = buffer;
+	if (speed == serial_speed)
+		return 0;
+	serial_speed = speed;
+	serial_send_switch_speed();
+	serial_send_eot();
+	pkt = serial_get_frame(&len, SERIAL_SYNC_USEC);
+	if (!pkt) {
+		/* the camera didn't get it, still at the old speed */
+		eot_sequence--;
+		serial_speed = old_speed;
+		return -1;
+	}
+	serial_change_serial_speed(serial_speed_code(speed));
 
-		for (i = 0; i < size; i++) {
-			written = write(fd, aux, 1);
-			if (written == -1)
-				return -1;
-			aux++;
+	for (retry = 0; retry < 5; retry++) {
+		serial_send_ping();
+		if (serial_get_frame(&len, SERIAL_SYNC_USEC) != NULL)
+			return 0;
+		eot_sequence--;
+	}
+
+	serial_speed = old_speed;
+	serial_change_serial_speed(serial_speed_code(old_speed));
+	serial_send_ping();
+	if (serial_get_frame(&len, SERIAL_SYNC_USEC) == NULL) {
+		eot_sequence--;
+		printf("serial link lost changing speed\n");
+	}
+	return -1;
+}
+
+static void serial_sleep_until(unsigned long long deadline)
+{
+#if defined(CLOCK_MONOTONIC) && defined(TIMER_ABSTIME)
+	struct timespec ts;
+
+	ts.tv_sec = deadline/1000000;
+	ts.tv_nsec = (deadline%1000000)*1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#else
+	unsigned long long now = get_mono_usec();
+
+	if (deadline > now)
+		usleep(deadline-now);
+#endif
+}
+
+/* The idle time the old write()+usleep(1) loop gave every byte, the
+ * shortest of a few usleep(1), once. */
+static int serial_pace_gap_usec(void)
+{
+	unsigned long long start, usec;
+	int j;
+
+	if (serial_pace_gap >= 0)
+		return serial_pace_gap;
+	if (!pace_measured) {
+		for (j = 0; j < 8; j++) {
+			start = get_mono_usec();
 			usleep(1);
+			usec = get_mono_usec() - start;
+			if (!pace_measured || usec < (unsigned)pace_measured)
+				pace_measured = usec ? usec : 1;
 		}
-		dump_hex("WRITE", buffer, size);
-	} else {
-		while(size) {
-			written = write(fd, buffer, size);
-			if (written == -1)
-				return -1;
-			dump_hex("WRITE", buffer, written);
-			size -= written;
-			buffer += written;
-		}
 	}
+	return pace_measured;
+}
+
+/* The A50/Pro70 needs some idle time between bytes. Instead of a
+ * write()+usleep() for every byte the buffer is written in chunks of
+ * serial_pace_chunk bytes, every chunk at its own absolute deadline, so
+ * that on average every byte takes one character time plus the gap of
+ * the old loop whatever the timer slack. If TIOCOUTQ says the UART is
+ * still busy with an earlier write the first deadline is moved on. */
+static int serial_paced_write(int fd, unsigned char *buffer, int size)
+{
+	unsigned long long start, deadline, now, char_usec, period;
+	int chunk;
+#ifdef TIOCOUTQ
+	int queued;
+#endif
+
+	char_usec = 10000000ULL/serial_speed; /* 8N1: 10 bits per byte */
+	period = char_usec + serial_pace_gap_usec();
+	start = deadline = get_mono_usec();
+#ifdef TIOCOUTQ
+	if (ioctl(fd, TIOCOUTQ, &queued) == 0 && queued > 0)
+		deadline += queued*period;
+#endif
+	while(size) {
+		now = get_mono_usec();
+		if (deadline > now)
+			serial_sleep_until(deadline);
+		chunk = (size < serial_pace_chunk) ? size : serial_pace_chunk;
+		if (sio_write(serial_port, buffer, chunk) == -1)
+			return -1;
+		buffer += chunk;
+		size -= chunk;
+		deadline += chunk*period;
+		pace_bytes += chunk;
+	}
+	pace_usec += get_mono_usec()-start;
 	return 0;
 }
 
+void serial_pace_stats(void)
+{
+	printf("A50 paced writer: %d bytes per write, "
+		"%d usec idle per byte%s\n", serial_pace_chunk,
+		serial_pace_gap_usec(), serial_pace_gap < 0 ? " (measured)" : "");
+	printf("sent %llu bytes in %llu ms, %llu bytes/s\n", pace_bytes,
+		pace_usec/1000, pace_usec ? pace_bytes*1000000/pace_usec : 0);
+}
+
+int serial_write(int fd, unsigned char *buffer, int size)
+{
+	unsigned long long start = get_mono_usec();
+	int retval;
+
+	if (opt_a50)
+		retval = serial_paced_write(fd, buffer, size);
+	else
+		retval = sio_write(serial_port, buffer, size);
+	trace_event(TR_SER_WRITE, 0, retval, buffer, size, start);
+	return retval == -1 ? -1 : 0;
+}
+
 int serial_send_frame(unsigned char *data, int len)
 {
-	int index = 0, j;
+	int index;
 	unsigned char aux[4096];
-	unsigned char buffer[4096];
+	unsigned char buffer[4096*2+2];
 	unsigned short cksum;
 
 	/* add the checksum */
@@ -193,25 +338,7 @@ int serial_send_frame(unsigned char *data, int len)
 	aux[len+1] = cksum >> 8;
 	len+=2;
 
-	buffer[index] = 0xC0;
-	index++;
-	for (j = 0; j < len; j++) {
-		switch(aux[j]) {
-		case 0x7e:
-		case 0xc0:
-		case 0xc1:
-			buffer[index] = 0x7e;
-			index++;
-			buffer[index] = aux[j] ^ 0x20;
-			break;
-		default:
-			buffer[index] = aux[j];
-			break;
-		}
-		index++;
-	}
-	buffer[index] = 0xC1;
-	index++;
+	index = sio_escape(buffer, aux, len);
 	return serial_write(fd, buffer, index);
 }
 
@@ -232,10 +359,9 @@ int serial_send_pkt_message(unsigned char *pkt, unsigned short len, int morefrag
 	return serial_send_frame(buffer, len+4);
 }
 
-int serial_send_message_frag(int type, unsigned char *frag, unsigned short len, int morefrag)
+/* the 16 bytes header of a message of the given type */
+static void serial_message_header(unsigned char *buffer, int type, unsigned short totlen)
 {
-	unsigned char buffer[4096];
-	unsigned short totlen;
 	unsigned char head[4];
 	unsigned char mtype;
 
@@ -256,17 +382,88 @@ int serial_send_message_frag(int type, unsigned char *frag, unsigned short len,
 	buffer[5] = 0x00;
 	buffer[6] = 0x00;
 	buffer[7] = msgtype_list[type][1]; /* direction: from PC to camera */
-	totlen = len + 16;
 	/* memcpy(&buffer[8], &totlen, sizeof(unsigned short)); */
 	buffer[8] = totlen & 0xff;
 	buffer[9] = totlen >> 8;
 	buffer[10] = 0x00;
 	buffer[11] = 0x00;
 	memcpy(&buffer[12], head, 4);
+}
+
+int serial_send_message_frag(int type, unsigned char *frag, unsigned short len, int morefrag)
+{
+	unsigned char buffer[4096];
+	unsigned short totlen;
+
+	/* a new message starts, the link speed may change only here */
+	if (!morefrag)
+		governor_check();
+
+	totlen = len + 16;
+	serial_message_header(buffer, type, totlen);
 	memcpy(&buffer[16], frag, len);
 	return serial_send_pkt_message(buffer, totlen, morefrag);
 }
 
+/* How many bytes of msg fit in one fragment frame once escaped. The
+ * packet header and the CRC may need escaping too: count them twice. */
+static int serial_frag_fit(unsigned char *msg, int len)
+{
+	int room = UPLOAD_FRAME_MAX - 2 - (4+2)*2;
+	int n = 0;
+
+	while(n < len) {
+		if (msg[n] == 0x7e || msg[n] == 0xc0 || msg[n] == 0xc1)
+			room -= 2;
+		else
+			room--;
+		if (room < 0)
+			break;
+		n++;
+	}
+	return n;
+}
+
+/* Send a message split in up to UPLOAD_FRAGS_MAX fragments closed by
+ * one EOT, resending what the camera asks for in the ACK. Returns 0 if
+ * the camera acknowledged the message, -2 if it needs more fragments,
+ * -1 on error. */
+static int serial_send_message_long(int type, unsigned char *data, int len)
+{
+	unsigned char msg[UPLOAD_MSG_MAX];
+	int off[UPLOAD_FRAGS_MAX+1];
+	int nfrags = 0, total = len+16, j, first = 0, tries, ack;
+
+	if (total > UPLOAD_MSG_MAX)
+		return -2;
+	serial_message_header(msg, type, total);
+	memcpy(msg+16, data, len);
+	for (j = 0; j < total; j += serial_frag_fit(msg+j, total-j)) {
+		if (nfrags == UPLOAD_FRAGS_MAX)
+			return -2;
+		off[nfrags++] = j;
+	}
+	off[nfrags] = total;
+
+	governor_check();
+	for (tries = 0; tries < 3; tries++) {
+		for (j = first; j < nfrags; j++) {
+			frag_sequence = j;
+			serial_send_pkt_message(msg+off[j], off[j+1]-off[j], j);
+		}
+		serial_send_eot_mask((1 << nfrags) - 1);
+		ack = serial_get_ack();
+		if (ack == ACK_ERROR_NONE)
+			return 0;
+		if (ack < 0)
+			return -1;
+		/* ACK_ERROR_RETRn wants fragment n again, and the ones after */
+		metrics_count(MET_RETRANSMITS, 1);
+		first = (ack >= 1 && ack <= nfrags) ? ack-1 : 0;
+	}
+	return -1;
+}
+
 int serial_send_ack(unsigned int ack_error)
 {
 	char ack[6];
@@ -308,21 +505,30 @@ int serial_send_switch_speed(void)
 	return result;
 }
 
-int serial_send_eot(void)
+/* the EOT length byte has a bit set for every fragment sent */
+int serial_send_eot_mask(unsigned char mask)
 {
 	char eot[6];
 
 	memcpy(eot, "\x00\x04\x01\x00\x00\x00", 6);
 	eot[0] = eot_sequence++;
+	eot[2] = mask;
+	metrics_cmd_start();
 	return serial_send_frame(eot, 6);
 }
 
+int serial_send_eot(void)
+{
+	return serial_send_eot_mask(0x01);
+}
+
 int serial_send_ping(void)
 {
 	char eot[6];
 
 	memcpy(eot, "\x00\x04\x00\x00\x00\x00", 6);
 	eot[0] = eot_sequence++;
+	metrics_cmd_start();
 	return serial_send_frame(eot, 6);
 }
 
@@ -332,90 +538,53 @@ int serial_send_switch_off(void)
 
         serial_write(fd, "\xC0\x00\x02\x55\x2C\xC1",6);
         result = serial_write(fd, "\xC0\x00\x04\x01\x00\x00\x00\x24\xC6\xC1",8);
-	sleep(1);
+	tcdrain(fd);
 	return result;
 }
 
-int serial_read(int fd, char *buffer, int size)
+/* a frame within usec, NULL on timeout or error */
+unsigned char *serial_get_frame(int *len, unsigned long usec)
 {
-	fd_set rfds;
-	struct timeval tv;
-	int retval;
-
-	FD_ZERO(&rfds);
-	FD_SET(fd, &rfds);
-	tv.tv_sec = serial_timeout;
-	tv.tv_usec = serial_u_timeout;
-
-	retval = select(fd+1, &rfds, NULL, NULL, &tv);
-	if (retval) {
-		return read(fd, buffer, size);
-	}
-	if (opt_debug)
-		printf("READ TIMEOUT\n");
-	return -1;
-}
+	unsigned long long start, deadline;
+	unsigned char *frame;
 
-int serial_get_byte(void)
-{
-	static unsigned char buffer[1024];
-	static int buffer_size = 0;
-	static unsigned char *buffer_pointer;
-	int n_read;
-
-	if (buffer_size == 0) {
-		n_read = serial_read(fd, buffer, 1024);
-		if (n_read <= 0)
-			return -1;
-		buffer_size = n_read;
-		buffer_pointer = buffer;
+	if (camera_lost) {
+		*len = SIO_ERROR;
+		return NULL;
 	}
-
-	buffer_size--;
-	buffer_pointer++;
-	return *(buffer_pointer-1);
-}
-
-unsigned char *serial_get_frame(int *len)
-{
-	static unsigned char buffer[4096];
-	int index = 0;
-	int c;
-
-	while((c = serial_get_byte()) != 0xC0) /* search the start */
-		if (c == -1) return NULL;
-	while((c = serial_get_byte()) != 0xC1) { /* C1 == end of the frame */
-		if (c == -1) return NULL;
-		if (c == 0x7e) {
-			c = serial_get_byte();
-			if (c == -1) return NULL;
-			c ^= 0x20;
-		}
-		buffer[index] = c;
-		index++;
-		if (index == 4096) {
-			fprintf(stderr, "FATAL ERROR serial_get_frame(): "
-					"not enough buffer\n");
-			exit(1);
+	start = get_mono_usec();
+	deadline = start + usec;
+	frame = sio_get_frame(serial_port, len, deadline);
+	trace_event(TR_SER_RECV, 0, *len, frame, frame ? *len : 0, start);
+	if (frame == NULL) {
+		if (*len == SIO_TIMEOUT) {
+			if (opt_debug)
+				printf("READ TIMEOUT\n");
+			governor_event(GOV_EV_TIMEOUT);
+			metrics_count(MET_TIMEOUTS, 1);
 		}
+		return NULL;
 	}
-	*len = index;
-	dump_hex("RECV", buffer, index);
 
 	/* the camera is no longer to PC mode? */
-	if (index >= 13 && !memcmp(buffer, "\x00\x00\x10\x00\x02\x00\x00\x00\x02\x00\x04\x00\x10", 13))
+	if (*len >= 13 && !memcmp(frame, "\x00\x00\x10\x00\x02\x00\x00\x00\x02\x00\x04\x00\x10", 13)) {
 		serial_nolonger_pcmode();
-	return buffer;
+		return NULL;
+	}
+	return frame;
 }
 
-unsigned char *serial_get_packet(struct header *hdr)
+/* the next frame, decoded, within usec */
+static unsigned char *serial_get_packet_usec(struct header *hdr,
+	unsigned long usec)
 {
 	unsigned char *frame;
 	int framelen;
 
-	frame = serial_get_frame(&framelen);
+	frame = serial_get_frame(&framelen, usec);
 	if (frame == NULL)
 		return NULL;
+	metrics_cmd_reply();
 
 	hdr->seq = frame[SEQ_OFFSET];
 	hdr->type = frame[TYPE_OFFSET];
@@ -425,9 +594,12 @@ unsigned char *serial_get_packet(struct header *hdr)
 	if (canon_psa50_chk_crc(frame, framelen-2, hdr->cksum) == 0) {
 		/* printf("BAD CRC RECEIVED\n"); */
 		hdr->cksum_ok = 0;
+		governor_event(GOV_EV_CRC);
+		metrics_count(MET_CRC_ERRORS, 1);
 	} else {
 		hdr->cksum_ok = 1;
 	}
+	governor_event(GOV_EV_FRAME);
 
 	switch(hdr->type) {
 	case PKT_TYPE_MSG:
@@ -451,6 +623,11 @@ unsigned char *serial_get_packet(struct header *hdr)
 	return frame;
 }
 
+unsigned char *serial_get_packet(struct header *hdr)
+{
+	return serial_get_packet_usec(hdr, SERIAL_REPLY_USEC);
+}
+
 int serial_get_ack(void)
 {
 	struct header hdr;
@@ -502,46 +679,144 @@ int serial_get_eot(void)
 	return 0;
 }
 
+static char *serial_state_path(void)
+{
+	static char path[1024];
+	char *home = getenv("HOME");
+
+	if (!home)
+		return NULL;
+	snprintf(path, 1024, "%s/%s", home, SERIAL_STATE_FILE);
+	return path;
+}
+
+/* Close the port but leave the camera in PC mode, saving what is
+ * needed to talk to it again without the handshake */
+int serial_suspend(void)
+{
+	char *path = serial_state_path();
+	FILE *fp;
+
+	if (fd == -1)
+		return -1;
+	if (path && (fp = fopen(path, "w")) != NULL) {
+		fprintf(fp, "%s %d %d %d %d %d\n", serialdev, serial_speed,
+			pkt_sequence, frag_sequence, eot_sequence,
+			ack_sequence);
+		fclose(fp);
+	} else if (path) {
+		perror(path);
+	}
+	tcdrain(fd);
+	sio_detach(serial_port);
+	serial_port = -1;
+	close(fd);
+	fd = -1;
+	return 0;
+}
+
+/* Ping the camera at the speed saved by serial_suspend(): if it answers
+ * it is still in PC mode and the handshake can be skipped. The state
+ * file is good for one try only. */
+static int serial_resume(char *device)
+{
+	char *path = serial_state_path();
+	char dev[1024];
+	int speed, pkt, frag, eot, ack, n, len, retry;
+	FILE *fp;
+
+	if (!path || (fp = fopen(path, "r")) == NULL)
+		return -1;
+	n = fscanf(fp, "%1023s %d %d %d %d %d", dev, &speed, &pkt, &frag,
+		&eot, &ack);
+	fclose(fp);
+	unlink(path);
+	if (n != 6 || strcmp(dev, device))
+		return -1;
+
+	serial_change_serial_speed(serial_speed_code(speed));
+	pkt_sequence = pkt;
+	frag_sequence = frag;
+	eot_sequence = eot;
+	ack_sequence = ack;
+	for (retry = 0; retry < 2; retry++) {
+		serial_send_ping();
+		if (serial_get_frame(&len, SERIAL_RESUME_USEC) != NULL)
+			break;
+		eot_sequence--;
+	}
+	if (retry == 2) {
+		serial_change_serial_speed(B9600);
+		(void) serial_flush_input();
+		pkt_sequence = frag_sequence = 0;
+		eot_sequence = ack_sequence = 0;
+		return -1;
+	}
+
+	/* the user may want another speed this time */
+	n = serial_speed;
+	serial_speed = speed;
+	if (n != speed && serial_relink(n) == -1)
+		printf("can't switch to %d bps, still at %d\n", n, speed);
+	return 0;
+}
+
 int serial_initial_sync(char *device)
 {
 	struct header hdr;
 	unsigned char *pkt;
 	int len;
+	unsigned long long start;
+	unsigned long timeout, cadence_max;
 
 	int retry = 0;
 	printf("Open %s: ", device);
+	start = get_mono_usec();
 	if (serial_init(device) == -1) {
 		printf("failure\n");
 		exit(1);
 	}
 	printf("OK\n");
+
+	if (serial_resume(device) == 0) {
+		printf("Resumed at %d bps in %llu ms\n", serial_speed,
+			(get_mono_usec()-start)/1000);
+		governor_start();
+		return 0;
+	}
 	printf("Sync: "); fflush(stdout);
 
-	/* set the delay between UUUU sequences */
-	serial_timeout = 0;
-	if (!opt_a50)
-		serial_u_timeout = 400000;
-	else
-		serial_u_timeout = 900000;
+	/* The delay between UUUU sequences starts short, the camera
+	 * usually answers at once, and grows up to the old fixed one.
+	 * A late answer is still picked up by the next read. */
+	if (!opt_a50) {
+		timeout = 100000;
+		cadence_max = 400000;
+	} else {
+		timeout = 250000;
+		cadence_max = 900000;
+	}
 
 	while(1) {
-		write(fd, "UUUU", 4);
-		pkt = serial_get_packet(&hdr);
+		serial_write(fd, (unsigned char *)"UUUU", 4);
+		pkt = serial_get_packet_usec(&hdr, timeout);
 		if (pkt) break;
 		printf("."); fflush(stdout);
+		timeout = timeout*3/2;
+		if (timeout > cadence_max)
+			timeout = cadence_max;
 	}
 	printf("\n");
 
 	printf("::%s::\n", (char*)(pkt+26));
-	pkt = serial_get_frame(&len); /* get the EOT */
+	pkt = serial_get_frame(&len, cadence_max); /* get the EOT */
 	serial_send_ack(ACK_ERROR_NONE);
 
 	/* set speed */
 	printf("Switching to %d bound ", serial_speed);
-	serial_timeout = 0;
 	serial_send_switch_speed();
 	serial_send_eot();
-	pkt = serial_get_frame(&len);
+	pkt = serial_get_frame(&len, cadence_max);
 
 	switch(serial_speed) {
 	case 9600:
@@ -568,7 +843,7 @@ int serial_initial_sync(char *device)
 	while(!pkt) {
 		printf("."); fflush(stdout);
 		serial_send_ping();
-		pkt = serial_get_frame(&len);
+		pkt = serial_get_frame(&len, cadence_max);
 		if (!pkt) eot_sequence--;
 		retry++;
 		if (retry == 10) {
@@ -576,7 +851,8 @@ int serial_initial_sync(char *device)
 			exit(1);
 		}
 	}
-	printf("OK\n");
+	printf("OK (%llu ms)\n", (get_mono_usec()-start)/1000);
+	governor_start();
 
 	return 0;
 }
@@ -632,15 +908,16 @@ void serial_ping(void)
 {
 	unsigned char *pkt;
 	int len, c;
-	unsigned long timestamp;
+	unsigned long long timestamp;
 
 	for (c = 0; c < 4; c++) {
-		timestamp = get_usec();
+		timestamp = get_mono_usec();
 		serial_send_ping();
-		pkt = serial_get_frame(&len);
-		timestamp = get_usec() - timestamp;
+		pkt = serial_get_frame(&len, SERIAL_REPLY_USEC);
+		timestamp = get_mono_usec() - timestamp;
 		if (pkt) {
-			printf("pong %d, %lu ms\n", c, timestamp);
+			metrics_cmd_reply();
+			printf("pong %d, %.3f ms\n", c, timestamp / 1000.0);
 		} else {
 			printf("time out\n");
 		}
@@ -757,13 +1034,14 @@ int serial_set_file_attrib(char *pathname, unsigned char newattrib)
 	return 0;
 }
 
-unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen)
+/* The file, or its thumbnail if reqtype is 1, into x. Returns its size
+ * or -1. */
+int serial_get_xfer(char *pathname, int reqtype, struct xfer *x)
 {
 	char aux[1024];
 	unsigned char *pkt;
 	struct header hdr;
 	int count, frag_count;
-	unsigned char *image = NULL;
 	int current_offset = 0;
 	int n_read = 0;
 	int last_current_offset = 0;
@@ -772,6 +1050,7 @@ unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen)
 	int totlen = 0;
 	int offset;
 	int size;
+	unsigned long long start;
 
 	memset(aux, 0, 5);
 	aux[0] = reqtype; /* set it to 0x01 for thumbnail 0x00 for image */
@@ -781,6 +1060,7 @@ unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen)
 	*(aux+8+strlen(pathname)) = 0x00;
 
 	serial_send_message_frag(MSG_TYPE_IMAGE, aux, 9+strlen(pathname), 0);
+	start = get_mono_usec();
 	serial_send_eot();
 	serial_get_ack();
 
@@ -797,6 +1077,7 @@ unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen)
 			/* error recovery */
 			if (last_sequence_bad_crc) {
 				printf("X");
+				metrics_count(MET_RETRANSMITS, 1);
 				serial_send_ack(ACK_ERROR_RETRALL);
 				current_offset = last_current_offset;
 				n_read = last_n_read;
@@ -810,8 +1091,8 @@ unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen)
 			last_sequence_bad_crc = 0;
 
 			if (n_read >= totlen) {
-				*retlen = n_read;
-				return image;
+				governor_goodput(n_read, get_mono_usec()-start);
+				return x->error ? -1 : n_read;
 			}
 			continue;
 		}
@@ -820,7 +1101,7 @@ unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen)
 			if (*(hdr.data+16) != 0x00 && count == 1) {
 				serial_get_eot();
 				serial_send_ack(ACK_ERROR_NONE);
-				return NULL;
+				return -1;
 			}
 
 			totlen = byteswap32(*(unsigned int*)(hdr.data+20));
@@ -828,21 +1109,23 @@ unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen)
 			size = byteswap32(*(unsigned int*)(hdr.data+28));
 
 			if (count == 1) {
-				image = malloc(totlen);
-				if (!image) {
-					perror("malloc");
-					safe_exit(1);
-				}
-				printf("Getting %s, %d bytes\n", pathname,
-					totlen);
+				xfer_begin(x, totlen);
+				if (!progress_quiet)
+					printf("Getting %s, %d bytes\n",
+						pathname, totlen);
 				progressbar(PROGRESS_RESET, 0, 0);
 			}
 
-			memcpy(image+current_offset, hdr.data+36, hdr.len-(36));
+			if (hdr.cksum_ok)
+				xfer_put(x, current_offset, hdr.data+36,
+					hdr.len-(36));
 			current_offset += (hdr.len-(36));
 			n_read += (hdr.len-(36));
 		} else {
-			memcpy(image+current_offset, hdr.data, hdr.len);
+			/* a bad fragment is sent again, and it may be
+			 * anything; keep it out of the streams */
+			if (hdr.cksum_ok)
+				xfer_put(x, current_offset, hdr.data, hdr.len);
 			current_offset += hdr.len;
 			n_read += hdr.len;
 		}
@@ -852,21 +1135,54 @@ unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen)
 	serial_send_ack(ACK_ERROR_NONE);
 }
 
+unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen)
+{
+	struct xfer x;
+
+	xfer_init(&x, OUT_WRITE, -1);
+	*retlen = serial_get_xfer(pathname, reqtype, &x);
+	if (*retlen == -1) {
+		xfer_end(&x, 0);
+		return NULL;
+	}
+	return x.buf;
+}
+
 void serial_debug_getpkt(void)
 {
 	unsigned char *pkt;
 	int len;
 
-	pkt = serial_get_frame(&len);
+	pkt = serial_get_frame(&len, SERIAL_REPLY_USEC);
 	return;
 }
 
 void serial_nolonger_pcmode(void)
 {
+	/* -W: back in PC mode soon, hopefully */
+	if (reconnect_secs) {
+		printf("*** your camera is no longer in PC mode\n");
+		camera_gone();
+		return;
+	}
 	printf("*** your camera is no longer in PC mode, exit\n");
 	exit(1);
 }
 
+/* -W: a new session on the same port, once the device is there */
+int serial_reopen(char *device)
+{
+	if (fd != -1) {
+		sio_detach(serial_port);
+		serial_port = -1;
+		close(fd);
+		fd = -1;
+	}
+	if (access(device, R_OK|W_OK) == -1)
+		return -1;
+	return serial_initial_sync(device);
+}
+
 int serial_get_power_status(int *good, int *ac)
 {
 	unsigned char *pkt;
@@ -943,18 +1259,13 @@ int serial_open(void)
 {
 	if (fd != -1)
 		return -1;
-	serial_send_switch_off();
-	close(fd);
 	pkt_sequence = 0;
 	frag_sequence = 0;
-	serial_timeout = 1;
-	serial_u_timeout = 0;
 	eot_sequence = 0;
 	ack_sequence = 0;
 	dirlist_size = 0;
 	lastpath[0] = '\0';
 	serial_initial_sync(serialdev);
-	serial_timeout = 5;
 	strncpy(cameraid, serial_get_id(), 1024);
 	strncpy(lastpath, serial_get_disk(), 1024);
 	return 0;
@@ -965,22 +1276,29 @@ int serial_close(void)
 	if (fd == -1)
 		return -1;
 	serial_send_switch_off();
+	sio_detach(serial_port);
+	serial_port = -1;
 	close(fd);
 	fd = -1; /* -1 means not connected */
 	return 0;
 }
 
+/* data bytes per upload message, halved when the camera refuses it */
+static int upload_chunk = UPLOAD_DATA_START;
+
 int serial_upload(char *source, char *target)
 {
 	struct stat buf;
-	unsigned char buffer[4096*2];
-	unsigned int offset, datalen, aux;
+	unsigned char buffer[UPLOAD_MSG_MAX+1024];
+	unsigned int offset, aux;
+	int datalen, hlen, result;
 	char arg[1024];
-	char read_buffer[1024];
+	unsigned char read_buffer[UPLOAD_MSG_MAX];
 	struct header hdr;
 	unsigned char *pkt;
 	int fd;
 	int progress_bar = 0;
+	unsigned long long start, usec;
 
 	if (target == NULL) {
 		char *p;
@@ -1017,40 +1335,87 @@ int serial_upload(char *source, char *target)
 		progressbar(PROGRESS_RESET, 0, 0);
 	}
 
+	start = get_mono_usec();
 	while(1) {
-		datalen = read(fd, read_buffer, 800);
+		if (lseek(fd, offset, SEEK_SET) == -1) {
+			perror("lseek");
+			close(fd);
+			return -1;
+		}
+		datalen = read(fd, read_buffer, upload_chunk);
 		if (datalen == 0) {
 			break;
 		} else if (datalen == -1) {
 			perror("read");
+			close(fd);
 			return -1;
 		}
 
-		/* 02 00 00 00 */
-		aux = byteswap32(0x02);
-		memcpy(buffer+0x00, &aux, 4);
-
-		/* offset */
-		aux = byteswap32(offset);
-		memcpy(buffer+0x04, &aux, 4);
-
-		/* datalen */
-		aux = byteswap32(datalen);
-		memcpy(buffer+0x08, &aux, 4);
-
-		memcpy(buffer+0x0c, target, strlen(target)+1);
-		memcpy(buffer+0x0c+strlen(target)+1, read_buffer, datalen);
+		/* many escaped bytes may not fit the fragments: send less */
+		do {
+			/* 02 00 00 00 */
+			aux = byteswap32(0x02);
+			memcpy(buffer+0x00, &aux, 4);
+
+			/* offset */
+			aux = byteswap32(offset);
+			memcpy(buffer+0x04, &aux, 4);
+
+			/* datalen */
+			aux = byteswap32(datalen);
+			memcpy(buffer+0x08, &aux, 4);
+
+			memcpy(buffer+0x0c, target, strlen(target)+1);
+			hlen = 0x0c+strlen(target)+1;
+			memcpy(buffer+hlen, read_buffer, datalen);
+
+			result = serial_send_message_long(MSG_TYPE_UPLOAD,
+				buffer, hlen+datalen);
+			if (result == -2)
+				datalen -= datalen/8 + 1;
+		} while(result == -2 && datalen > 0);
+
+		if (datalen <= 0) {
+			printf("upload failed at offset %u: no data fits "
+				"the message\n", offset);
+			close(fd);
+			return -1;
+		}
 
-		serial_send_message_frag(MSG_TYPE_UPLOAD, buffer, 12+strlen(target)+1+datalen, 0); 
-		serial_send_eot(); 
-		serial_get_ack(); 
-		pkt = serial_get_packet(&hdr); /* data  */
-		serial_get_eot();
-		serial_send_ack(ACK_ERROR_NONE);
+		pkt = NULL;
+		if (result == 0) {
+			pkt = serial_get_packet(&hdr); /* data  */
+			if (pkt && hdr.type == PKT_TYPE_MSG) {
+				serial_get_eot();
+				serial_send_ack(ACK_ERROR_NONE);
+			} else {
+				pkt = NULL;
+			}
+		}
+		if (pkt == NULL) {
+			(void) serial_flush_input();
+			if (upload_chunk == UPLOAD_DATA_MIN) {
+				printf("upload failed at offset %u\n", offset);
+				close(fd);
+				return -1;
+			}
+			upload_chunk /= 2;
+			if (upload_chunk < UPLOAD_DATA_MIN)
+				upload_chunk = UPLOAD_DATA_MIN;
+			if (opt_debug)
+				printf("upload: trying %d bytes per message\n",
+					upload_chunk);
+			continue;
+		}
 
 		offset += datalen;
-		progressbar(PROGRESS_PRINT, buf.st_size, offset);
+		if (progress_bar)
+			progressbar(PROGRESS_PRINT, buf.st_size, offset);
 	}
 	close(fd);
+	usec = get_mono_usec()-start;
+	printf("%u bytes uploaded in %llu ms, %llu bytes/s, "
+		"up to %d bytes per message\n", offset, usec/1000,
+		usec ? offset*1000000ULL/usec : 0, upload_chunk);
 	return 0;
 }
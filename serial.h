@@ -69,6 +69,22 @@ struct header {
 #define ACK_ERROR_RETR8		0x08
 #define ACK_ERROR_RETRALL	0xFF
 
+/* multi-fragment upload */
+#define UPLOAD_FRAME_MAX	1022	/* escaped fragment frame size limit */
+#define UPLOAD_FRAGS_MAX	8	/* fragments per EOT */
+#define UPLOAD_MSG_MAX		(UPLOAD_FRAGS_MAX*UPLOAD_FRAME_MAX)
+#define UPLOAD_DATA_START	7680	/* first try, data bytes per message */
+#define UPLOAD_DATA_MIN		800	/* the old single fragment size */
+
+/* session resume */
+#define SERIAL_STATE_FILE	".s10sh_state"	/* in $HOME */
+#define SERIAL_RESUME_USEC	200000	/* ping timeout at the old speed */
+
+/* how long a frame is waited for */
+#define SERIAL_REPLY_USEC	5000000	/* an answer to a command */
+#define SERIAL_SYNC_USEC	1000000	/* a speed change and its pings */
+#define SERIAL_A50_SETTLE	200000	/* A50 pause after a speed change */
+
 /* serial speed changing commands */
 #define SPEED_9600	"\x0F\xC0\x00\x03\x02\x02\x01\x10" \
 			"\x00\x00\x00\x00\x7e\xe0\x39\xC1"
@@ -83,18 +99,21 @@ struct header {
 
 extern int fd, pkt_sequence;
 extern unsigned char frag_sequence;
-extern int serial_timeout;
-extern int serial_u_timeout;
+extern int serial_port;
 extern unsigned char eot_sequence;
 extern unsigned char ack_sequence;
 extern struct termios backup, new;
 extern int serial_speed;
 extern char *serialdev;
 extern int opt_a50;
+extern int opt_keep_pcmode;
+extern int serial_pace_chunk;
+extern int serial_pace_gap;
 extern unsigned char *msgtype_list[];
 
 /* function prototypes */
 int serial_write(int fd, unsigned char *buffer, int size);
+void serial_pace_stats(void);
 int serial_send_frame(unsigned char *data, int len);
 int serial_send_pkt_message(unsigned char *pkt, unsigned short len, int morefrag);
 int serial_send_message_frag(int type, unsigned char *frag, unsigned short len, int morefrag);
@@ -102,19 +121,20 @@ int serial_send_ack(unsigned int ack_error);
 int serial_get_ack(void);
 int serial_send_switch_speed(void);
 int serial_send_eot(void);
+int serial_send_eot_mask(unsigned char mask);
 int serial_send_ping(void);
 int serial_send_switch_off(void);
-int serial_read(int fd, char *buffer, int size);
-int serial_get_byte(void);
-unsigned char *serial_get_frame(int *len);
+unsigned char *serial_get_frame(int *len, unsigned long usec);
 unsigned char *serial_get_packet(struct header *hdr);
 int serial_initial_sync(char *device);
+int serial_suspend(void);
 char *serial_get_id(void);
 char *serial_get_disk(void);
 void serial_ping(void);
 int serial_get_disk_info(char *disk, int *size, int *free);
 void serial_debug_getpkt(void);
 void serial_nolonger_pcmode(void);
+int serial_reopen(char *device);
 int serial_get_power_status(int *good, int *ac);
 int serial_test_message(int msgtype);
 time_t serial_get_date(void);
@@ -123,7 +143,10 @@ int serial_flush_input(void);
 int serial_flush_output(void);
 int serial_init(char *device);
 int serial_change_serial_speed(int speed);
+int serial_speed_code(int speed);
+int serial_relink(int speed);
 unsigned char *serial_get_data(char *pathname, int reqtype, int *retlen);
+int serial_get_xfer(char *pathname, int reqtype, struct xfer *x);
 int serial_open(void);
 int serial_close(void);
 int serial_mkdir(char *pathname);
@@ -0,0 +1,131 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * SHA-256 (FIPS 180-4), fed a chunk at a time while a file arrives.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sha256.h"
+
+static const unsigned int k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32-(n))))
+
+static void transform(unsigned int *h, const unsigned char *p)
+{
+	unsigned int w[64], a, b, c, d, e, f, g, hh, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++, p += 4)
+		w[i] = (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	for (; i < 64; i++)
+		w[i] = w[i-16] + w[i-7] +
+			(ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3)) +
+			(ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10));
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+	for (i = 0; i < 64; i++) {
+		t1 = hh + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+			((e & f) ^ (~e & g)) + k[i] + w[i];
+		t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+			((a & b) ^ (a & c) ^ (b & c));
+		hh = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+void sha256_init(struct sha256 *c)
+{
+	static const unsigned int iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(c->h, iv, sizeof(iv));
+	c->len = 0;
+	c->fill = 0;
+}
+
+/* whole blocks straight from data, only the rest is copied */
+void sha256_update(struct sha256 *c, const unsigned char *data,
+	unsigned int len)
+{
+	unsigned int n;
+
+	c->len += len;
+	if (c->fill) {
+		n = 64 - c->fill;
+		if (n > len)
+			n = len;
+		memcpy(c->block+c->fill, data, n);
+		c->fill += n;
+		data += n;
+		len -= n;
+		if (c->fill < 64)
+			return;
+		transform(c->h, c->block);
+		c->fill = 0;
+	}
+	for (; len >= 64; data += 64, len -= 64)
+		transform(c->h, data);
+	memcpy(c->block, data, len);
+	c->fill = len;
+}
+
+void sha256_final(struct sha256 *c, unsigned char *digest)
+{
+	unsigned long long bits = c->len * 8;
+	int i;
+
+	c->block[c->fill++] = 0x80;
+	if (c->fill > 56) {
+		memset(c->block+c->fill, 0, 64 - c->fill);
+		transform(c->h, c->block);
+		c->fill = 0;
+	}
+	memset(c->block+c->fill, 0, 56 - c->fill);
+	for (i = 0; i < 8; i++)
+		c->block[56+i] = bits >> (56 - i*8);
+	transform(c->h, c->block);
+	for (i = 0; i < 8; i++) {
+		digest[i*4] = c->h[i] >> 24;
+		digest[i*4+1] = c->h[i] >> 16;
+		digest[i*4+2] = c->h[i] >> 8;
+		digest[i*4+3] = c->h[i];
+	}
+}
+
+char *sha256_hex(unsigned char *digest, char *hex)
+{
+	int i;
+
+	for (i = 0; i < SHA256_LEN; i++)
+		sprintf(hex+i*2, "%02x", digest[i]);
+	return hex;
+}
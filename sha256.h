@@ -0,0 +1,28 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#define SHA256_LEN	32
+
+struct sha256 {
+	unsigned int h[8];
+	unsigned long long len;		/* bytes hashed */
+	unsigned char block[64];
+	unsigned int fill;
+};
+
+void sha256_init(struct sha256 *c);
+void sha256_update(struct sha256 *c, const unsigned char *data,
+	unsigned int len);
+void sha256_final(struct sha256 *c, unsigned char *digest);
+char *sha256_hex(unsigned char *digest, char *hex);
+
+#endif
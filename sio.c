@@ -0,0 +1,430 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Serial I/O core: non-blocking ports served by one epoll (or select)
+ * loop. Every port owns a ring buffer for the raw input and a queue of
+ * decoded frames (C0 ... C1, 0x7E escaped) for the protocol layer.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#ifdef __linux__
+#define SIO_EPOLL
+#include <sys/epoll.h>
+#endif
+#include "s10sh.h"
+
+/* frame decoder states */
+#define SIO_HUNT	0	/* waiting for C0 */
+#define SIO_DATA	1	/* inside a frame */
+#define SIO_ESC		2	/* after 0x7E */
+
+#define SIO_RING_MASK	(SIO_RING_SIZE-1)
+
+struct sio_port {
+	int fd;
+	int dead;		/* EOF or read error */
+	unsigned char ring[SIO_RING_SIZE];
+	unsigned int head, tail; /* free running, head = write side */
+	int state;
+	int curlen;
+	unsigned char cur[SIO_FRAME_MAX];
+	int fq_head, fq_count;
+	int fq_len[SIO_FRAMEQ];
+	unsigned char fq[SIO_FRAMEQ][SIO_FRAME_MAX];
+	unsigned char out[SIO_FRAME_MAX]; /* last frame given out */
+	unsigned long long rx_bytes;
+	unsigned long frames, dropped, overflows;
+};
+
+static struct sio_port *sio_ports[SIO_MAX_PORTS];
+#ifdef SIO_EPOLL
+static int sio_epfd = -1;
+#endif
+
+static struct sio_port *sio_port(int port)
+{
+	if (port < 0 || port >= SIO_MAX_PORTS)
+		return NULL;
+	return sio_ports[port];
+}
+
+int sio_attach(int fd)
+{
+	struct sio_port *p;
+	int port, flags;
+#ifdef SIO_EPOLL
+	struct epoll_event ev;
+#endif
+
+	for (port = 0; port < SIO_MAX_PORTS; port++)
+		if (sio_ports[port] == NULL)
+			break;
+	if (port == SIO_MAX_PORTS) {
+		printf("sio_attach(): too many ports\n");
+		return -1;
+	}
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags|O_NONBLOCK) == -1) {
+		perror("fcntl");
+		return -1;
+	}
+#ifdef SIO_EPOLL
+	if (sio_epfd == -1 && (sio_epfd = epoll_create(SIO_MAX_PORTS)) == -1) {
+		perror("epoll_create");
+		return -1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = port;
+	if (epoll_ctl(sio_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		perror("epoll_ctl");
+		return -1;
+	}
+#endif
+	p = malloc(sizeof(struct sio_port));
+	if (!p) {
+		printf("sio_attach(): out of memory\n");
+		exit(1);
+	}
+	p->fd = fd;
+	p->dead = 0;
+	p->head = p->tail = 0;
+	p->state = SIO_HUNT;
+	p->curlen = 0;
+	p->fq_head = p->fq_count = 0;
+	p->rx_bytes = 0;
+	p->frames = p->dropped = p->overflows = 0;
+	sio_ports[port] = p;
+	return port;
+}
+
+/* the caller still owns (and closes) the file descriptor */
+void sio_detach(int port)
+{
+	struct sio_port *p = sio_port(port);
+
+	if (!p)
+		return;
+#ifdef SIO_EPOLL
+	if (!p->dead)
+		epoll_ctl(sio_epfd, EPOLL_CTL_DEL, p->fd, NULL);
+#endif
+	fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) & ~O_NONBLOCK);
+	free(p);
+	sio_ports[port] = NULL;
+}
+
+/* drop everything received so far, in the kernel and here */
+void sio_flush(int port)
+{
+	struct sio_port *p = sio_port(port);
+
+	if (!p)
+		return;
+	tcflush(p->fd, TCIFLUSH);
+	p->head = p->tail = 0;
+	p->state = SIO_HUNT;
+	p->curlen = 0;
+	p->fq_head = p->fq_count = 0;
+}
+
+static void sio_store(struct sio_port *p, unsigned char c)
+{
+	if (p->curlen == SIO_FRAME_MAX) {
+		if (opt_debug)
+			printf("sio: frame too long, dropped\n");
+		p->overflows++;
+		p->state = SIO_HUNT;
+		return;
+	}
+	p->cur[p->curlen++] = c;
+}
+
+/* Move bytes from the ring to the frame queue. Stops when the queue
+ * is full: the bytes stay in the ring and then in the kernel. */
+static void sio_decode(struct sio_port *p)
+{
+	unsigned char c;
+	int slot;
+
+	while(p->tail != p->head) {
+		c = p->ring[p->tail & SIO_RING_MASK];
+		switch(p->state) {
+		case SIO_HUNT:
+			if (c == 0xC0) {
+				p->state = SIO_DATA;
+				p->curlen = 0;
+			}
+			break;
+		case SIO_DATA:
+			if (c == 0xC1) {
+				if (p->fq_count == SIO_FRAMEQ)
+					return;
+				slot = (p->fq_head+p->fq_count) % SIO_FRAMEQ;
+				memcpy(p->fq[slot], p->cur, p->curlen);
+				p->fq_len[slot] = p->curlen;
+				p->fq_count++;
+				p->frames++;
+				p->state = SIO_HUNT;
+			} else if (c == 0xC0) { /* lost the end, restart */
+				p->dropped++;
+				p->curlen = 0;
+			} else if (c == 0x7E) {
+				p->state = SIO_ESC;
+			} else {
+				sio_store(p, c);
+			}
+			break;
+		case SIO_ESC:
+			p->state = SIO_DATA;
+			sio_store(p, c ^ 0x20);
+			break;
+		}
+		p->tail++;
+	}
+}
+
+/* Frame the buffer: C0, the data with 7E, C0 and C1 escaped, C1.
+ * dst needs room for 2*len+2 bytes, the frame length is returned. */
+int sio_escape(unsigned char *dst, unsigned char *src, int len)
+{
+	unsigned char *d = dst;
+	int j;
+
+	*d++ = 0xC0;
+	for (j = 0; j < len; j++) {
+		switch(src[j]) {
+		case 0x7e:
+		case 0xc0:
+		case 0xc1:
+			*d++ = 0x7e;
+			*d++ = src[j] ^ 0x20;
+			break;
+		default:
+			*d++ = src[j];
+			break;
+		}
+	}
+	*d++ = 0xC1;
+	return d - dst;
+}
+
+/* Give the port bytes received by other means, as if read from its
+ * file descriptor. Returns how many were taken, the ring may be full. */
+int sio_feed(int port, unsigned char *buffer, int size)
+{
+	struct sio_port *p = sio_port(port);
+	unsigned int space, off;
+	int n, done = 0;
+
+	if (!p)
+		return -1;
+	while(done < size) {
+		space = SIO_RING_SIZE - (p->head - p->tail);
+		if (space == 0)
+			break;
+		off = p->head & SIO_RING_MASK;
+		if (space > SIO_RING_SIZE - off)
+			space = SIO_RING_SIZE - off;
+		n = size - done;
+		if (n > (int)space)
+			n = space;
+		memcpy(p->ring+off, buffer+done, n);
+		p->head += n;
+		p->rx_bytes += n;
+		done += n;
+	}
+	sio_decode(p);
+	return done;
+}
+
+/* read what the kernel has for this port into the ring */
+static void sio_input(struct sio_port *p)
+{
+	unsigned int space, off;
+	int n;
+
+	while(!p->dead) {
+		space = SIO_RING_SIZE - (p->head - p->tail);
+		if (space == 0)
+			break;
+		off = p->head & SIO_RING_MASK;
+		if (space > SIO_RING_SIZE - off)
+			space = SIO_RING_SIZE - off;
+		n = read(p->fd, p->ring+off, space);
+		if (n > 0) {
+			p->head += n;
+			p->rx_bytes += n;
+			continue;
+		}
+		if (n == -1 && (errno == EINTR))
+			continue;
+		if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			p->dead = 1;
+#ifdef SIO_EPOLL
+			/* a hung up tty would wake us up forever */
+			epoll_ctl(sio_epfd, EPOLL_CTL_DEL, p->fd, NULL);
+#endif
+		}
+		break;
+	}
+	sio_decode(p);
+}
+
+/* Wait for input on any port until the absolute monotonic deadline
+ * (0 = just look) and decode it. Returns the number of ports that got
+ * input, 0 on timeout, -1 on error. */
+int sio_poll(unsigned long long deadline)
+{
+	unsigned long long now;
+	int port, n, ready = 0;
+#ifdef SIO_EPOLL
+	struct epoll_event ev[SIO_MAX_PORTS];
+	int timeout = 0;
+
+	now = get_mono_usec();
+	if (deadline > now)
+		timeout = (deadline-now+999)/1000;
+	if (sio_epfd == -1)
+		return -1;
+	n = epoll_wait(sio_epfd, ev, SIO_MAX_PORTS, timeout);
+	if (n == -1)
+		return (errno == EINTR) ? 0 : -1;
+	while(n--) {
+		port = ev[n].data.u32;
+		if (sio_ports[port]) {
+			sio_input(sio_ports[port]);
+			ready++;
+		}
+	}
+#else
+	fd_set rfds;
+	struct timeval tv;
+	int maxfd = -1;
+
+	FD_ZERO(&rfds);
+	for (port = 0; port < SIO_MAX_PORTS; port++) {
+		if (!sio_ports[port] || sio_ports[port]->dead)
+			continue;
+		FD_SET(sio_ports[port]->fd, &rfds);
+		if (sio_ports[port]->fd > maxfd)
+			maxfd = sio_ports[port]->fd;
+	}
+	if (maxfd == -1)
+		return -1;
+	now = get_mono_usec();
+	tv.tv_sec = tv.tv_usec = 0;
+	if (deadline > now) {
+		tv.tv_sec = (deadline-now)/1000000;
+		tv.tv_usec = (deadline-now)%1000000;
+	}
+	n = select(maxfd+1, &rfds, NULL, NULL, &tv);
+	if (n == -1)
+		return (errno == EINTR) ? 0 : -1;
+	for (port = 0; n > 0 && port < SIO_MAX_PORTS; port++) {
+		if (!sio_ports[port] || !FD_ISSET(sio_ports[port]->fd, &rfds))
+			continue;
+		sio_input(sio_ports[port]);
+		ready++;
+		n--;
+	}
+#endif
+	return ready;
+}
+
+int sio_frames_ready(int port)
+{
+	struct sio_port *p = sio_port(port);
+
+	return p ? p->fq_count : 0;
+}
+
+/* Get the next frame of the port, serving all the ports while waiting.
+ * The frame stays valid until the next call for the same port. On
+ * failure NULL is returned and *len is SIO_TIMEOUT or SIO_ERROR. */
+unsigned char *sio_get_frame(int port, int *len, unsigned long long deadline)
+{
+	struct sio_port *p = sio_port(port);
+
+	if (!p) {
+		*len = SIO_ERROR;
+		return NULL;
+	}
+	while(p->fq_count == 0) {
+		/* the queue was full, the ring may hold more frames */
+		sio_decode(p);
+		if (p->fq_count)
+			break;
+		if (p->dead) {
+			*len = SIO_ERROR;
+			return NULL;
+		}
+		if (get_mono_usec() >= deadline) {
+			*len = SIO_TIMEOUT;
+			return NULL;
+		}
+		if (sio_poll(deadline) == -1) {
+			*len = SIO_ERROR;
+			return NULL;
+		}
+	}
+	*len = p->fq_len[p->fq_head];
+	memcpy(p->out, p->fq[p->fq_head], *len);
+	p->fq_head = (p->fq_head+1) % SIO_FRAMEQ;
+	p->fq_count--;
+	return p->out;
+}
+
+/* write all the buffer, waiting for the port when the kernel is full */
+int sio_write(int port, unsigned char *buffer, int size)
+{
+	struct sio_port *p = sio_port(port);
+	fd_set wfds;
+	int n;
+
+	if (!p)
+		return -1;
+	while(size) {
+		n = write(p->fd, buffer, size);
+		if (n > 0) {
+			buffer += n;
+			size -= n;
+			continue;
+		}
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		FD_ZERO(&wfds);
+		FD_SET(p->fd, &wfds);
+		if (select(p->fd+1, NULL, &wfds, NULL, NULL) == -1 &&
+		    errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+void sio_stats(int port)
+{
+	struct sio_port *p = sio_port(port);
+
+	if (!p)
+		return;
+	printf("port %d: %llu bytes in, %lu frames, %lu dropped, "
+		"%lu too long, %u bytes and %d frames pending\n",
+		port, p->rx_bytes, p->frames, p->dropped, p->overflows,
+		p->head - p->tail, p->fq_count);
+}
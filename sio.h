@@ -0,0 +1,33 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_SIO_H
+#define S10SH_SIO_H
+
+#define SIO_MAX_PORTS	8
+#define SIO_RING_SIZE	65536	/* raw input bytes per port, power of 2 */
+#define SIO_FRAME_MAX	4096	/* decoded frame size limit */
+#define SIO_FRAMEQ	16	/* decoded frames queued per port */
+
+/* sio_get_frame() results besides a frame */
+#define SIO_TIMEOUT	-1
+#define SIO_ERROR	-2
+
+int sio_attach(int fd);
+void sio_detach(int port);
+void sio_flush(int port);
+int sio_poll(unsigned long long deadline);
+int sio_frames_ready(int port);
+unsigned char *sio_get_frame(int port, int *len, unsigned long long deadline);
+int sio_write(int port, unsigned char *buffer, int size);
+int sio_escape(unsigned char *dst, unsigned char *src, int len);
+int sio_feed(int port, unsigned char *buffer, int size);
+void sio_stats(int port);
+
+#endif /* S10SH_SIO_H */
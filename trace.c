@@ -0,0 +1,238 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Protocol event ring: every USB and serial transfer leaves a fixed
+ * size binary record here, always on. Nothing is formatted until the
+ * ring is dumped ('trace dump', SIGUSR1, exit on error) or shown
+ * ('trace'); s10trace decodes the dumps offline.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include "s10sh.h"
+
+static struct trace_event trace_ring[TRACE_EVENTS];
+static unsigned int trace_total = 0;	/* events since the start */
+unsigned int trace_errors = 0;
+char trace_file[1024];
+
+static void trace_signal(int sid)
+{
+	static char msg[] = "\ntrace: ring dumped\n";
+
+	if (trace_dump(trace_file) == 0)
+		write(1, msg, sizeof(msg)-1);
+}
+
+/* Set the dump file, NULL for /tmp/s10sh-<pid>.trace, and arm SIGUSR1 */
+void trace_init(char *filename)
+{
+	if (filename)
+		snprintf(trace_file, sizeof(trace_file), "%s", filename);
+	else
+		snprintf(trace_file, sizeof(trace_file),
+			"/tmp/s10sh-%d.trace", (int)getpid());
+	signal(SIGUSR1, trace_signal);
+}
+
+/* Record a transfer that started at start (get_mono_usec()) and just
+ * ended. A negative retval is an error. */
+void trace_event(int kind, int value, int retval, const void *data,
+	int len, unsigned long long start)
+{
+	struct trace_event *e;
+	int cap;
+
+	e = &trace_ring[trace_total++ & (TRACE_EVENTS-1)];
+	e->usec = get_mono_usec();
+	e->dur = e->usec - start;
+	e->len = len;
+	e->retval = retval;
+	e->value = value;
+	e->kind = kind;
+	cap = len < TRACE_DATA ? len : TRACE_DATA;
+	if (cap < 0 || data == NULL)
+		cap = 0;
+	e->caplen = cap;
+	memcpy(e->data, data, cap);
+	if (retval < 0)
+		trace_errors++;
+}
+
+void trace_mark(const char *what)
+{
+	unsigned long long now = get_mono_usec();
+
+	trace_event(TR_MARK, 0, 0, what, strlen(what), now);
+}
+
+void trace_clear(void)
+{
+	trace_total = 0;
+	trace_errors = 0;
+}
+
+/* only write(), it runs from the signal handler too */
+int trace_dump(const char *filename)
+{
+	struct trace_header h;
+	unsigned int count, first;
+	int fd, ok;
+
+	count = trace_total < TRACE_EVENTS ? trace_total : TRACE_EVENTS;
+	first = (trace_total - count) & (TRACE_EVENTS-1);
+	memcpy(h.magic, TRACE_MAGIC, 4);
+	h.version = TRACE_VERSION;
+	h.evsize = sizeof(struct trace_event);
+	h.count = count;
+	h.total = trace_total;
+	h.errors = trace_errors;
+	h.now = get_mono_usec();
+
+	fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd == -1)
+		return -1;
+	ok = write(fd, &h, sizeof(h)) == sizeof(h);
+	if (first + count > TRACE_EVENTS) {
+		ok = ok && write(fd, trace_ring+first,
+			(TRACE_EVENTS-first)*h.evsize) ==
+			(TRACE_EVENTS-first)*h.evsize;
+		count -= TRACE_EVENTS-first;
+		first = 0;
+	}
+	ok = ok && write(fd, trace_ring+first, count*h.evsize) ==
+		count*h.evsize;
+	close(fd);
+	return ok ? 0 : -1;
+}
+
+/* the last n events on stdout, for the 'trace' command */
+void trace_show(int n, int hex)
+{
+	static struct trace_event ev[TRACE_EVENTS];
+	unsigned int count, j;
+
+	count = trace_total < TRACE_EVENTS ? trace_total : TRACE_EVENTS;
+	if (n > 0 && (unsigned int)n < count)
+		count = n;
+	for (j = 0; j < count; j++)
+		ev[j] = trace_ring[(trace_total-count+j) & (TRACE_EVENTS-1)];
+	trace_print(stdout, ev, count, hex);
+	printf("%u events, %u errors\n", trace_total, trace_errors);
+}
+
+static char *trace_kind_name(int kind)
+{
+	switch(kind) {
+	case TR_MARK:		return "MARK";
+	case TR_USB_CMD:	return "USB-CMD";
+	case TR_USB_CTRL_OUT:	return "CTRL-OUT";
+	case TR_USB_CTRL_IN:	return "CTRL-IN";
+	case TR_USB_BULK_OUT:	return "BULK-OUT";
+	case TR_USB_BULK_IN:	return "BULK-IN";
+	case TR_SER_WRITE:	return "SER-WRITE";
+	case TR_SER_RECV:	return "SER-RECV";
+	default:		return "?";
+	}
+}
+
+static void trace_hex(FILE *fp, struct trace_event *e)
+{
+	int j, k;
+
+	for (j = 0; j < e->caplen; j += 16) {
+		fprintf(fp, "    %04x: ", j);
+		for (k = j; k < j+16; k++) {
+			if (k < e->caplen)
+				fprintf(fp, "%02x ", e->data[k]);
+			else
+				fprintf(fp, "   ");
+		}
+		fprintf(fp, " ");
+		for (k = j; k < j+16 && k < e->caplen; k++)
+			fputc(e->data[k] >= 32 && e->data[k] < 127 ?
+				e->data[k] : '.', fp);
+		fprintf(fp, "\n");
+	}
+}
+
+/* one line per event, time from the first one and duration in ms */
+void trace_print(FILE *fp, struct trace_event *ev, int count, int hex)
+{
+	struct trace_event *e;
+	int j;
+
+	for (j = 0; j < count; j++) {
+		e = ev+j;
+		fprintf(fp, "%12.3f %9.3f  %-9s ",
+			(e->usec - ev[0].usec) / 1000.0, e->dur / 1000.0,
+			trace_kind_name(e->kind));
+		if (e->kind == TR_MARK) {
+			fprintf(fp, "%.*s\n", e->caplen, e->data);
+			continue;
+		}
+		fprintf(fp, "%04x len %u ret %d%s\n", e->value, e->len,
+			e->retval, e->retval < 0 ? " ERROR" : "");
+		if (hex)
+			trace_hex(fp, e);
+	}
+}
+
+/* Per phase summary, a phase goes from a TR_MARK to the next one:
+ * wall time, time inside the transfers, bytes and errors. */
+void trace_phases(FILE *fp, struct trace_event *ev, int count)
+{
+	unsigned long long start, io, out, in;
+	int j, events, errors;
+	char name[TRACE_DATA+1];
+
+	if (count == 0)
+		return;
+	fprintf(fp, "%-24s %10s %10s %7s %10s %10s %6s\n", "phase",
+		"wall_ms", "io_ms", "events", "out", "in", "errors");
+	strcpy(name, "(start)");
+	start = ev[0].usec - ev[0].dur;
+	io = out = in = 0;
+	events = errors = 0;
+	for (j = 0; j <= count; j++) {
+		struct trace_event *e = ev+j;
+
+		if (j == count || e->kind == TR_MARK) {
+			if (events || j == count)
+				fprintf(fp, "%-24s %10.3f %10.3f %7d %10llu "
+					"%10llu %6d\n", name,
+					((j == count ? ev[count-1].usec :
+					  e->usec) - start) / 1000.0,
+					io / 1000.0, events, out, in, errors);
+			if (j == count)
+				break;
+			snprintf(name, sizeof(name), "%.*s", e->caplen,
+				e->data);
+			start = e->usec;
+			io = out = in = 0;
+			events = errors = 0;
+			continue;
+		}
+		events++;
+		if (e->kind == TR_USB_CMD)
+			continue;
+		io += e->dur;
+		if (e->retval < 0) {
+			errors++;
+			continue;
+		}
+		if (e->kind == TR_USB_CTRL_OUT || e->kind == TR_USB_BULK_OUT ||
+		    e->kind == TR_SER_WRITE)
+			out += e->kind == TR_SER_WRITE ? e->len : e->retval;
+		else
+			in += e->retval;
+	}
+}
@@ -0,0 +1,66 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_TRACE_H
+#define S10SH_TRACE_H
+
+#include <stdio.h>
+
+#define TRACE_EVENTS	4096	/* events in the ring, power of 2 */
+#define TRACE_DATA	32	/* payload bytes kept per event */
+
+/* event kinds */
+#define TR_MARK		1	/* a shell command, the data is its text */
+#define TR_USB_CMD	2	/* USB_cmd(), value is cmd1<<8|cmd2 */
+#define TR_USB_CTRL_OUT	3
+#define TR_USB_CTRL_IN	4
+#define TR_USB_BULK_OUT	5
+#define TR_USB_BULK_IN	6
+#define TR_SER_WRITE	7
+#define TR_SER_RECV	8	/* a decoded frame, or SIO_TIMEOUT/SIO_ERROR */
+
+struct trace_event {
+	unsigned long long usec;	/* end of the call, get_mono_usec() */
+	unsigned int dur;		/* usec spent in the call */
+	unsigned int len;		/* requested size */
+	int retval;
+	unsigned short value;		/* endpoint, control value, command */
+	unsigned char kind;
+	unsigned char caplen;		/* payload bytes kept */
+	unsigned char data[TRACE_DATA];
+};
+
+/* dump file: this header, then the events oldest first, native
+ * byte order */
+#define TRACE_MAGIC	"S10B"
+#define TRACE_VERSION	1
+struct trace_header {
+	char magic[4];
+	unsigned int version;
+	unsigned int evsize;		/* sizeof(struct trace_event) */
+	unsigned int count;		/* events in the file */
+	unsigned int total;		/* events since the start */
+	unsigned int errors;
+	unsigned long long now;		/* time of the dump */
+};
+
+extern unsigned int trace_errors;
+extern char trace_file[];
+
+void trace_init(char *filename);
+void trace_event(int kind, int value, int retval, const void *data,
+	int len, unsigned long long start);
+void trace_mark(const char *what);
+int trace_dump(const char *filename);
+void trace_clear(void);
+void trace_show(int n, int hex);
+void trace_print(FILE *fp, struct trace_event *ev, int count, int hex);
+void trace_phases(FILE *fp, struct trace_event *ev, int count);
+
+#endif /* S10SH_TRACE_H */
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <errno.h>
 #ifdef __linux__
 #include <asm/page.h>
 #endif /* __linux__ */
@@ -284,27 +285,45 @@ USB_camera_init(struct usb_device **camera_dev)
 	return NOCAMERA;
 }
 
+/* No device: the session is over, until camera_reconnect(). libusb
+ * 0.1 returns the failed ioctl as -1 and leaves the cause in errno. */
+static void USB_check_lost(int retval, int err)
+{
+	if (retval == -ENODEV || retval == -ESHUTDOWN ||
+	    err == ENODEV || err == ESHUTDOWN)
+		camera_gone();
+}
+
 /* The following two functions are based on gpio library */
 static int 
 USB_write_control_msg(int value, char *buffer, int size)
 {
-	int retval;
-
-	retval = usb_control_msg(cameraudh,
-				USB_TYPE_VENDOR|USB_RECIP_DEVICE|USB_DIR_OUT,
-				size > 1 ? 0x04 : 0x0c,
-				value,
-				0,
-				buffer,
-				size,
-				usb_timeout);
-
-	if (opt_debug && 0) {
-		printf("WRITE CONTROL MSG, type %X, value %X, size %d: %s\n",
-			USB_TYPE_VENDOR|USB_RECIP_DEVICE|USB_DIR_OUT,
-			value, size, retval == -1 ? "FAILED" : "OK");
-		if (retval != -1)
-			dump_hex("DATA", buffer, size);
+	unsigned long long start = get_mono_usec();
+	int retval, err;
+
+	if (camera_lost)
+		return -ENODEV;
+	if (usbtrace_mode == USBTRACE_REPLAY)
+		return usbtrace_replay(USBTRACE_CTRL_OUT, value, buffer, size);
+	errno = 0;
+	if (mode == VIRTUAL_MODE)
+		retval = vcam_control_msg(0, value, buffer, size);
+	else
+		retval = usb_control_msg(cameraudh,
+					USB_TYPE_VENDOR|USB_RECIP_DEVICE|USB_DIR_OUT,
+					size > 1 ? 0x04 : 0x0c,
+					value,
+					0,
+					buffer,
+					size,
+					usb_timeout);
+	err = errno;
+	if (usbtrace_mode == USBTRACE_RECORD)
+		usbtrace_record(USBTRACE_CTRL_OUT, value, retval, buffer, size);
+	trace_event(TR_USB_CTRL_OUT, value, retval, buffer, size, start);
+	if (retval < 0) {
+		metrics_count(MET_XFER_ERRORS, 1);
+		USB_check_lost(retval, err);
 	}
 	return retval;
 }
@@ -312,15 +331,36 @@ USB_write_control_msg(int value, char *buffer, int size)
 static int 
 USB_read_control_msg(int value, char *buffer, int size)
 {
-	int retval;
-	retval = usb_control_msg(cameraudh,
-				USB_TYPE_VENDOR|USB_RECIP_DEVICE|USB_DIR_IN,
-				size > 1 ? 0x04 : 0x0c,
-				value,
-				0,
-				buffer,
-				size,
-				usb_timeout);
+	unsigned long long start = get_mono_usec();
+	int retval, err = 0;
+
+	if (camera_lost)
+		return -ENODEV;
+	if (usbtrace_mode == USBTRACE_REPLAY) {
+		retval = usbtrace_replay(USBTRACE_CTRL_IN, value, buffer, size);
+	} else {
+		errno = 0;
+		if (mode == VIRTUAL_MODE)
+			retval = vcam_control_msg(1, value, buffer, size);
+		else
+			retval = usb_control_msg(cameraudh,
+						USB_TYPE_VENDOR|USB_RECIP_DEVICE|USB_DIR_IN,
+						size > 1 ? 0x04 : 0x0c,
+						value,
+						0,
+						buffer,
+						size,
+						usb_timeout);
+		err = errno;
+		if (usbtrace_mode == USBTRACE_RECORD)
+			usbtrace_record(USBTRACE_CTRL_IN, value, retval,
+				buffer, size);
+	}
+	trace_event(TR_USB_CTRL_IN, value, retval, buffer, size, start);
+	if (retval < 0) {
+		metrics_count(MET_XFER_ERRORS, 1);
+		USB_check_lost(retval, err);
+	}
 	if (opt_debug) {
 		printf("READ CONTROL MSG, value %X, size %d: %s\n",
 			value, size, retval == -1 ? "FAILED" : "OK");
@@ -359,26 +399,61 @@ USB_read_control_msg(int value, char *buffer, int size)
 
 int USB_read(void *buffer, int size)
 {
-	int retval;
-
-	retval = usb_bulk_read(cameraudh, input_ep, buffer, size, usb_timeout);
-	if (opt_debug) {
-		printf("USB READ: %s (%X)\n", retval == -1 ? "FAILED" : "OK", retval);
-		if (retval != -1)
-			dump_hex("DATA", buffer, size);
+	unsigned long long start = get_mono_usec();
+	int retval, err = 0;
+
+	if (camera_lost)
+		return -ENODEV;
+	if (usbtrace_mode == USBTRACE_REPLAY) {
+		retval = usbtrace_replay(USBTRACE_BULK_IN, input_ep,
+			buffer, size);
+	} else {
+		errno = 0;
+		if (mode == VIRTUAL_MODE)
+			retval = vcam_bulk_read(buffer, size);
+		else
+			retval = usb_bulk_read(cameraudh, input_ep, buffer,
+				size, usb_timeout);
+		err = errno;
+		if (usbtrace_mode == USBTRACE_RECORD)
+			usbtrace_record(USBTRACE_BULK_IN, input_ep, retval,
+				buffer, size);
 	}
+	trace_event(TR_USB_BULK_IN, input_ep, retval, buffer, size, start);
+	if (retval < 0) {
+		metrics_count(MET_XFER_ERRORS, 1);
+		USB_check_lost(retval, err);
+	} else
+		metrics_cmd_reply();
 	return retval;
 }
 
 int USB_write(void *buffer, int size)
 {
-	int retval;
-
-	retval = usb_bulk_write(cameraudh, output_ep, buffer, size, usb_timeout);
-	if (opt_debug) {
-		printf("USB WRITE: %s (%X)\n", retval == -1? "FAILED" : "OK", retval);
-		if (retval != -1)
-			dump_hex("DATA", buffer, size);
+	unsigned long long start = get_mono_usec();
+	int retval, err = 0;
+
+	if (camera_lost)
+		return -ENODEV;
+	if (usbtrace_mode == USBTRACE_REPLAY) {
+		retval = usbtrace_replay(USBTRACE_BULK_OUT, output_ep,
+			buffer, size);
+	} else {
+		errno = 0;
+		if (mode == VIRTUAL_MODE)
+			retval = vcam_bulk_write(buffer, size);
+		else
+			retval = usb_bulk_write(cameraudh, output_ep, buffer,
+				size, usb_timeout);
+		err = errno;
+		if (usbtrace_mode == USBTRACE_RECORD)
+			usbtrace_record(USBTRACE_BULK_OUT, output_ep, retval,
+				buffer, size);
+	}
+	trace_event(TR_USB_BULK_OUT, output_ep, retval, buffer, size, start);
+	if (retval < 0) {
+		metrics_count(MET_XFER_ERRORS, 1);
+		USB_check_lost(retval, err);
 	}
 	return retval;
 }
@@ -404,71 +479,135 @@ int USB_cmd(unsigned char cmd1, unsigned char cmd2, unsigned int cmd3, unsigned
 	*(unsigned int*)(buffer+0x4c) = byteswap32(serial);
 	if (payload != NULL)
 		memcpy(buffer+USB_HEADER_SIZE, payload, size);
+	trace_event(TR_USB_CMD, (cmd1 << 8) | cmd2, 0, payload, size,
+		get_mono_usec());
+	metrics_cmd_start();
 	return USB_write_control_msg(0x10, buffer, USB_HEADER_SIZE+size);
 }
 
-void USB_initial_sync(void)
+/* open the camera found on the bus, -1 on errors */
+static int USB_open_camera(struct usb_device *camera_dev)
 {
-	struct usb_device *camera_dev;
-        int retval;
-        unsigned char buffer[4096];
-	USB_INIT_RESULT init_val;
-
-	usb_timeout = 500;
-	init_val = USB_camera_init(&camera_dev);
-	if (init_val == NOCAMERA) {
-		if (opt_debug)
-			printf("\n");
-		printf("Camera not found, please press the shot button and\n"
-			"  check that the camera is in PC mode, then retry.\n");
-		if (!opt_debug)
-			printf("Use the -D option to determine the PRODUCT ID and\n"
-				" modify the source code to support this camera if appropriate.\n");
-		if (opt_debug)
-			printf("If you understand the DANGER to your CAMERA try the\n"
-				" -Z command line option and FORCE the camera support.\n"
-				"READ and UNDERSTAND the dangers in the README files FIRST!\n");
-		exit(1);
-	} else if (init_val == USB_INIT_FAILED) {
-		printf("Fatal error initializing USB\n");
-		exit(1);
-	} else if (init_val == USB_INIT_DANGER) {
-		printf("DANGER: This camera was not found specifically listed;\n"
-			"       using the -Z override MAY DAMAGE YOUR CAMERA!\n");
-	}
+	int retval;
 
 	cameraudh = usb_open(camera_dev);
 	if (!cameraudh) {
 		printf("usb_open() error, can't open the camera\n");
-		exit(1);
+		return -1;
 	}
 
         retval = usb_set_configuration(cameraudh, configuration);
         if (retval == USB_ERROR) {
                 printf("usb_set_configuration() error\n");
-                exit(1);
+                return -1;
         }
 
         retval = usb_claim_interface(cameraudh, interface);
         if (retval == USB_ERROR) {
                 printf("usb_claim_interface() error\n");
-                exit(1);
+                return -1;
         }
 
         retval = usb_set_altinterface(cameraudh, alternate);
         if (retval == USB_ERROR) {
                 printf("usb_set_altinterface() error\n");
-                exit(1);
+                return -1;
         }
 
         if (opt_debug)
                 printf("USB: Camera successful open\n");
+	return 0;
+}
 
-        while (USB_read_control_msg(0x55, buffer, 1) == -1);
+/* the handshake of a new session, -1 if the camera goes away */
+static int USB_sync(void)
+{
+        unsigned char buffer[4096];
+
+	usb_timeout = 500;
+        while (USB_read_control_msg(0x55, buffer, 1) == -1 && !camera_lost);
         USB_read_control_msg(0x1, buffer, 0x58);
         USB_write_control_msg(0x11, buffer+0x48, sync_size(camera_model));
         USB_read(buffer, 0x44);
 	usb_timeout = 3000;
+	return camera_lost ? -1 : 0;
+}
+
+/* -W: the camera is on the bus again, a new session with it. Only the
+ * handshake, the rest is as it was. */
+int USB_reopen(void)
+{
+	struct usb_device *camera_dev;
+	USB_INIT_RESULT init_val;
+
+	if (mode == VIRTUAL_MODE) {
+		if (!vcam_present())
+			return -1;
+		vcam_attach();
+	} else if (usbtrace_mode != USBTRACE_REPLAY) {
+		if (cameraudh) {
+			usb_close(cameraudh);
+			cameraudh = NULL;
+		}
+		/* camera_dev is set only when a camera is there */
+		init_val = USB_camera_init(&camera_dev);
+		if ((init_val != CAMERA_FOUND &&
+		     init_val != USB_INIT_DANGER) ||
+		    USB_open_camera(camera_dev) == -1)
+			return -1;
+	}
+	return USB_sync();
+}
+
+void USB_initial_sync(void)
+{
+	struct usb_device *camera_dev;
+	USB_INIT_RESULT init_val;
+
+	if (usbtrace_mode == USBTRACE_REPLAY || mode == VIRTUAL_MODE) {
+		/* no camera: the model comes from the trace or vcam.c */
+		if (opt_debug)
+			printf("USB: %s\n", mode == VIRTUAL_MODE ?
+				"virtual camera" : "replaying a recorded session");
+		goto sync;
+	}
+	init_val = USB_camera_init(&camera_dev);
+	/* -W: not there yet, it may be on its way */
+	if (init_val == NOCAMERA && reconnect_secs) {
+		camera_lost = 1;
+		camera_reconnect();
+		return;
+	}
+	if (init_val == NOCAMERA) {
+		if (opt_debug)
+			printf("\n");
+		printf("Camera not found, please press the shot button and\n"
+			"  check that the camera is in PC mode, then retry.\n");
+		if (!opt_debug)
+			printf("Use the -D option to determine the PRODUCT ID and\n"
+				" modify the source code to support this camera if appropriate.\n");
+		if (opt_debug)
+			printf("If you understand the DANGER to your CAMERA try the\n"
+				" -Z command line option and FORCE the camera support.\n"
+				"READ and UNDERSTAND the dangers in the README files FIRST!\n");
+		exit(1);
+	} else if (init_val == USB_INIT_FAILED) {
+		printf("Fatal error initializing USB\n");
+		exit(1);
+	} else if (init_val == USB_INIT_DANGER) {
+		printf("DANGER: This camera was not found specifically listed;\n"
+			"       using the -Z override MAY DAMAGE YOUR CAMERA!\n");
+	}
+
+	if (USB_open_camera(camera_dev) == -1)
+		exit(1);
+
+sync:
+	/* -W: gone in the middle of the handshake */
+	if (USB_sync() == -1 && !camera_recover()) {
+		printf("USB protocol error, retry\n");
+		exit(1);
+	}
 }
 
 char *USB_get_id(void)
@@ -549,17 +688,99 @@ char *USB_set_owner(char *name)
         return buffer+0x5c;
 }
 
+/* The newest entry of a folder, the one with the largest number:
+ * a NNNCANON folder if dirs, an IMG_NNNN file otherwise. The ls cache
+ * and the current folder are left alone. Returns the number, 0 if
+ * there is none, -1 on error. */
+static int USB_newest(char *pathname, int dirs, char *name)
+{
+	unsigned char aux[1024], *message, *p, *end;
+	struct canonfile entry;
+	int len, num, newest = 0;
+
+	len = strlen(pathname);
+	if (len+4 > (int)sizeof(aux))
+		return -1;
+	aux[0] = DL_NO_RECURSION;
+	memcpy(aux+1, pathname, len);
+	memset(aux+1+len, 0, 3);
+	USB_cmd(0x0b, 0x11, 0x202, 0x01, aux, len+4);
+	if (USB_read(aux, 0x40) == -1)
+		return -1;
+	len = byteswap32(*(unsigned int*)(aux+6));
+	if (len <= 10)
+		return -1;
+	message = malloc(len);
+	if (!message) {
+		perror("malloc");
+		exit(1);
+	}
+	end = message+len;
+	if (USB_read(message, len) == -1 || message[0] != 0x80 ||
+	    (p = memchr(message+10, '\0', len-10)) == NULL) {
+		free(message);
+		return -1;
+	}
+	p++;
+	while(parse_list_entry(&p, end, &entry) == 1) {
+		if (strlen(entry.name) != (dirs ? 8 : 12))
+			continue;
+		num = atoi(dirs ? entry.name : entry.name+4);
+		if (num > newest) {
+			newest = num;
+			strcpy(name, entry.name);
+		}
+	}
+	free(message);
+	return newest;
+}
+
+/* Where the shots go: the newest folder of DCIM, looked up again only
+ * when the last one has nothing new, the camera may have opened the
+ * next folder. */
+static char capture_folder[sizeof(dcimpath)+16] = "";
+static int capture_last = -1;	/* newest file number before the shot */
+
+static int capture_newest(char *name)
+{
+	char folder[16], path[sizeof(capture_folder)];
+	int num = -1;
+
+	if (capture_folder[0]) {
+		num = USB_newest(capture_folder, 0, name);
+		if (num > 0 && num != capture_last)
+			return num;
+	}
+	if (USB_newest(dcimpath, 1, folder) <= 0)
+		return num;
+	snprintf(path, sizeof(path), "%s\\%s", dcimpath, folder);
+	if (!strcmp(path, capture_folder))
+		return num;
+	strcpy(capture_folder, path);
+	return USB_newest(capture_folder, 0, name);
+}
+
+/* Remote capture. The end of the shot and then the new file are polled
+ * for every CAPTURE_POLL_USEC, the timing of every phase is reported. */
 char *USB_control_camera(void)
 {
-        int retval, counter;
-        static char buffer[USB_BUFFER_SIZE];
-        unsigned char xxxx[0x20];
+	int retval, num, timeout;
+	static char buffer[USB_BUFFER_SIZE];
+	unsigned char xxxx[0x20];
+	char name[16];
+	unsigned long long start, t_mode, t_release, t_done, t_visible;
 
 	unsigned char cntl_command = 0x13;	
         if (get_camera_class(camera_model) == canon_class6) {
 		cntl_command = 0x25;
 	}
 
+	/* what is already on the card, the first time only */
+	if (capture_last == -1)
+		capture_last = capture_newest(name);
+
+	start = get_mono_usec();
+	trace_mark("capture init");
 	/* Control Init */
 	memset(xxxx, 0, 0x20);
 	xxxx[0] = 0x00;
@@ -585,8 +806,10 @@ char *USB_control_camera(void)
         retval = USB_read(buffer, USB_BUFFER_SIZE);
         if (retval == -1)
                 return NULL;
+	t_mode = get_mono_usec();
 
 	/* Release Shutter */
+	trace_mark("capture release");
 	memset(xxxx, 0, 0x20);
 	xxxx[0] = 0x04;
 	xxxx[1] = 0x00;
@@ -594,47 +817,52 @@ char *USB_control_camera(void)
         retval = USB_read(buffer, USB_BUFFER_SIZE);
         if (retval == -1)
                 return NULL;
+	t_release = get_mono_usec();
 
-	/* Control Exit */
-	/* Need a delay here to wait until the camera has finished */
+	/* Control Exit, the camera answers when it has finished. A short
+	 * read timeout, a busy camera costs a poll and not a second. */
+	trace_mark("capture exit");
 	memset(xxxx, 0, 0x20);
         xxxx[0] = 0x01;
         xxxx[1] = 0x00;
-	for (counter = 3; counter > 1; counter--) {
-		fprintf(stderr, "%02d\b\b", counter);
-		sleep(1);
-		if (counter < 9) {
-        		USB_cmd(cntl_command, 0x12, 0x201, 0x01, xxxx, 0x18);
-        		retval = USB_read(buffer, USB_BUFFER_SIZE);
-        		if (retval != -1)
-                		counter = 0;
-		}
+	timeout = usb_timeout;
+	usb_timeout = CAPTURE_POLL_MS;
+	while(1) {
+        	USB_cmd(cntl_command, 0x12, 0x201, 0x01, xxxx, 0x18);
+        	retval = USB_read(buffer, USB_BUFFER_SIZE);
+		if (retval != -1 ||
+		    get_mono_usec() - t_release > CAPTURE_TIMEOUT_USEC)
+			break;
+		usleep(CAPTURE_POLL_USEC);
 	}
+	usb_timeout = timeout;
+	t_done = get_mono_usec();
+	if (retval == -1)
+		printf("capture: no answer to control exit\n");
 
-	mydisplay = 0;
-	retval = camera_get_list(lastpath);
-	mydisplay = 1;
-        if (retval == -1) {
-            printf("ls error\n");
-	    return NULL;
-        }
-
-        int j, largest=0, current;
-        char big[1024];
-        char aux[1024];
-        for (j = 0; j < dirlist_size; j++) {
-               snprintf(aux, 5, "%s", dirlist[j]->name+4);
-               current=atoi(aux);
-              if (current > largest) {
-                   largest=current;
-                   snprintf(big, 1024, "%s", dirlist[j]->name);
-              }
-              /* printf("LenBig=%d, aux=%s, current=%d, largest=%d, file=%s\n", strlen(big), aux, current, largest, big);*/
+	/* the new file is the newest of the capture folder */
+	trace_mark("capture file");
+	while(1) {
+		num = capture_newest(name);
+		if ((num > 0 && num != capture_last) ||
+		    get_mono_usec() - t_done > CAPTURE_TIMEOUT_USEC)
+			break;
+		usleep(CAPTURE_POLL_USEC);
 	}
-	if (strlen(big) == 12 ) 
-		snprintf(buffer+0x5c, sizeof(big), "%s", big);
-        else 
-		snprintf(buffer+0x5c, sizeof(big), "UNKNOWN");
+	t_visible = get_mono_usec();
+
+	printf("%s: init %.1f ms, release %.1f ms, complete %.1f ms, "
+		"file %.1f ms, shutter to file %.1f ms\n", cameraid,
+		(t_mode-start)/1e3, (t_release-t_mode)/1e3,
+		(t_done-t_release)/1e3, (t_visible-t_done)/1e3,
+		(t_visible-t_mode)/1e3);
+	if (num <= 0 || num == capture_last) {
+		snprintf(buffer+0x5c, 16, "UNKNOWN");
+		return buffer+0x5c;
+	}
+	metrics_observe(MET_CAPTURE, t_visible-t_mode);
+	capture_last = num;
+	snprintf(buffer+0x5c, 16, "%s", name);
 	return buffer+0x5c;
 }
 
@@ -965,14 +1193,34 @@ char *USB_get_disk(void)
 }
 
 #define BULK_TR_SIZE	0x1000 /* PAGE_SIZE */
-unsigned char *USB_get_data(char *pathname, int reqtype, int *retlen)
+int usb_xfer_size = BULK_TR_SIZE;	/* bulk read size of the downloads */
+
+/* What is left of a broken transfer, so that the next reply is not
+ * mistaken for it. */
+static void USB_drain(void)
+{
+	unsigned char *buffer = malloc(usb_xfer_size);
+	int saved = usb_timeout;
+
+	if (!buffer)
+		return;
+	usb_timeout = USB_DRAIN_MS;
+	while(USB_read(buffer, usb_xfer_size) > 0)
+		;
+	usb_timeout = saved;
+	free(buffer);
+}
+
+/* The file, or its thumbnail if reqtype is 1, into x. Returns its size
+ * or -1. */
+int USB_get_xfer(char *pathname, int reqtype, struct xfer *x)
 {
 	unsigned char buffer[4096*2];
-	unsigned char *image;
-	int aux = BULK_TR_SIZE;
+	unsigned char *chunk;
+	int aux = usb_xfer_size;
 	int size;
-	int totalsize;
-	int n_read = 0;
+	int totalsize, retlen;
+	int n_read = 0, got;
 	int offset = 8;
 
 	memset(buffer, 0, 4);
@@ -983,28 +1231,49 @@ unsigned char *USB_get_data(char *pathname, int reqtype, int *retlen)
 	*(unsigned int*)(buffer+4) = byteswap32(aux);
         memcpy(buffer+offset, pathname, strlen(pathname)+1);
 	USB_cmd(0x01, 0x11, 0x202, 0x01, buffer, strlen(pathname)+offset+1);
-        USB_read(buffer, 0x40);
+        if (USB_read(buffer, 0x40) < 0)
+		return -1;
 	totalsize = byteswap32(*(unsigned int*)(buffer+6));
 	if (totalsize == 0)
-		return NULL;
-	*retlen = totalsize;
-	image = malloc(totalsize);
-	if (!image) {
-		perror("malloc");
-		exit(1);
-	}
+		return -1;
+	retlen = totalsize;
+	xfer_begin(x, totalsize);
 
-	printf("Getting %s, %d bytes\n", pathname, totalsize);
+	if (!progress_quiet)
+		printf("Getting %s, %d bytes\n", pathname, totalsize);
 	progressbar(PROGRESS_RESET, 0, 0);
-       	while(1) {
-               	size = (totalsize > BULK_TR_SIZE) ? BULK_TR_SIZE : totalsize;
-               	USB_read(image+n_read, size);
-               	totalsize -= size;
-		n_read += size;
-		progressbar(PROGRESS_PRINT, *retlen, n_read);
-               	if (totalsize == 0) break;
+	/* a short read is only part of the chunk, the next read goes on
+	 * from there; no data at all ends the transfer */
+       	while(totalsize) {
+               	size = (totalsize > usb_xfer_size) ? usb_xfer_size : totalsize;
+		chunk = xfer_chunk(x, n_read, size);
+		got = USB_read(chunk, size);
+		if (got <= 0) {
+			printf("\n===ERROR===> %s: %d of %d bytes received\n",
+				pathname, n_read, retlen);
+			if (!camera_lost)
+				USB_drain();
+			return -1;
+		}
+		xfer_put(x, n_read, chunk, got);
+		totalsize -= got;
+		n_read += got;
+		progressbar(PROGRESS_PRINT, retlen, n_read);
        	}
-	return image;
+	return x->error ? -1 : retlen;
+}
+
+unsigned char *USB_get_data(char *pathname, int reqtype, int *retlen)
+{
+	struct xfer x;
+
+	xfer_init(&x, OUT_WRITE, -1);
+	*retlen = USB_get_xfer(pathname, reqtype, &x);
+	if (*retlen == -1) {
+		xfer_end(&x, 0);
+		return NULL;
+	}
+	return x.buf;
 }
 
 char *USB_setdate(void)
@@ -1303,6 +1572,15 @@ void USB_close(void)
 {
 	int retval;
 
+	if (usbtrace_mode == USBTRACE_REPLAY || mode == VIRTUAL_MODE) {
+		usbtrace_close();
+		if (mode == VIRTUAL_MODE)
+			vcam_stats();
+		return;
+	}
+	usbtrace_close();
+	if (camera_lost)
+		return;	/* -W, the handle is gone with the camera */
 	retval = usb_release_interface(cameraudh, interface);
 	if (retval == USB_ERROR) {
 		printf("usb_claim_interface() error\n");
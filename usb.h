@@ -59,11 +59,20 @@
 /* libusb prototypes */
 int usb_find_busses(void);
 
+extern int usb_xfer_size;
+
 /* USB specific prototypes */
+/* remote capture */
+#define CAPTURE_POLL_USEC	50000	/* end of the shot, new file */
+#define CAPTURE_POLL_MS		200	/* read timeout of a poll */
+#define CAPTURE_TIMEOUT_USEC	10000000
+#define USB_DRAIN_MS		500	/* the rest of a broken transfer */
+
 int USB_read(void *buffer, int size);
 int USB_write(void *buffer, int size);
 int USB_cmd(unsigned char cmd1, unsigned char cmd2, unsigned int cmd3, unsigned int serial, unsigned char *payload, int size);
 void USB_initial_sync(void);
+int USB_reopen(void);
 char *USB_get_id(void);
 unsigned int *USB_body_id(void);
 char *USB_set_owner(char *name);
@@ -77,6 +86,7 @@ int   USB_focus(int start);
 int   USB_shots(void);
 char *USB_get_disk(void);
 unsigned char *USB_get_data(char *pathname, int reqtype, int *retlen);
+int USB_get_xfer(char *pathname, int reqtype, struct xfer *x);
 time_t USB_get_date(void);
 char *USB_setdate(void);
 int USB_get_disk_info(char *disk, int *size, int *free);
@@ -0,0 +1,243 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * USB session record and replay. Every bulk and control transfer of
+ * usb.c is logged with its direction, result, payload and a monotonic
+ * timestamp; on replay the trace answers in place of the camera.
+ *
+ * File format (all the integers are little endian):
+ *
+ *   header: "S10T" version(1) camera_model(1) 0(2) start_time_usec(8)
+ *   record: kind(1) 0(3) value(4) retval(4) len(4) usec(8) payload(len)
+ *
+ * value is the endpoint for bulk transfers and the request value for
+ * control messages, usec is the time since the start of the session.
+ * OUT records hold the data sent, IN records the data received.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "s10sh.h"
+
+int usbtrace_mode = USBTRACE_OFF;
+
+static FILE *trace_fp = NULL;
+static unsigned long long trace_start;	/* monotonic, session start */
+static unsigned long long trace_last;	/* usec of the last record */
+static unsigned long trace_records, trace_mismatches;
+static unsigned long long trace_bytes_in, trace_bytes_out;
+static unsigned char trace_payload[USBTRACE_PAYLOAD_MAX];
+
+static char *kind_name[] = { "?", "CTRL OUT", "CTRL IN", "BULK OUT", "BULK IN" };
+
+static void put32(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static unsigned int get32(unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void put64(unsigned char *p, unsigned long long v)
+{
+	put32(p, v & 0xffffffff);
+	put32(p+4, v >> 32);
+}
+
+static unsigned long long get64(unsigned char *p)
+{
+	return get32(p) | ((unsigned long long)get32(p+4) << 32);
+}
+
+static int is_out(int kind)
+{
+	return kind == USBTRACE_CTRL_OUT || kind == USBTRACE_BULK_OUT;
+}
+
+int usbtrace_record_open(char *filename)
+{
+	unsigned char hdr[USBTRACE_HDR_SIZE];
+	struct timeval tv;
+
+	trace_fp = fopen(filename, "w");
+	if (!trace_fp) {
+		perror("usbtrace: fopen");
+		return -1;
+	}
+	gettimeofday(&tv, NULL);
+	memset(hdr, 0, USBTRACE_HDR_SIZE);
+	memcpy(hdr, USBTRACE_MAGIC, 4);
+	hdr[4] = USBTRACE_VERSION;
+	hdr[5] = 0; /* camera model, known after the detection */
+	put64(hdr+8, (unsigned long long)tv.tv_sec*1000000+tv.tv_usec);
+	if (fwrite(hdr, USBTRACE_HDR_SIZE, 1, trace_fp) != 1) {
+		perror("usbtrace: fwrite");
+		fclose(trace_fp);
+		trace_fp = NULL;
+		return -1;
+	}
+	trace_start = get_mono_usec();
+	usbtrace_mode = USBTRACE_RECORD;
+	return 0;
+}
+
+/* The camera model is read back from the trace, the replay skips the
+ * USB bus scan. */
+int usbtrace_replay_open(char *filename)
+{
+	unsigned char hdr[USBTRACE_HDR_SIZE];
+
+	trace_fp = fopen(filename, "r");
+	if (!trace_fp) {
+		perror("usbtrace: fopen");
+		return -1;
+	}
+	if (fread(hdr, USBTRACE_HDR_SIZE, 1, trace_fp) != 1 ||
+	    memcmp(hdr, USBTRACE_MAGIC, 4)) {
+		printf("usbtrace: %s is not a s10sh USB trace\n", filename);
+		fclose(trace_fp);
+		trace_fp = NULL;
+		return -1;
+	}
+	if (hdr[4] != USBTRACE_VERSION) {
+		printf("usbtrace: %s has trace version %d, %d expected\n",
+			filename, hdr[4], USBTRACE_VERSION);
+		fclose(trace_fp);
+		trace_fp = NULL;
+		return -1;
+	}
+	camera_model = hdr[5];
+	trace_start = get_mono_usec();
+	usbtrace_mode = USBTRACE_REPLAY;
+	return 0;
+}
+
+void usbtrace_record(int kind, int value, int retval, void *data, int size)
+{
+	unsigned char rec[USBTRACE_REC_SIZE];
+	int len;
+
+	if (!trace_fp || usbtrace_mode != USBTRACE_RECORD)
+		return;
+	if (is_out(kind))
+		len = size;
+	else
+		len = (retval > 0) ? retval : 0;
+	if (len > size)
+		len = size;
+	if (len > USBTRACE_PAYLOAD_MAX)
+		len = USBTRACE_PAYLOAD_MAX;
+
+	trace_last = get_mono_usec() - trace_start;
+	memset(rec, 0, USBTRACE_REC_SIZE);
+	rec[0] = kind;
+	put32(rec+4, value);
+	put32(rec+8, retval);
+	put32(rec+12, len);
+	put64(rec+16, trace_last);
+	if (fwrite(rec, USBTRACE_REC_SIZE, 1, trace_fp) != 1 ||
+	    (len && fwrite(data, len, 1, trace_fp) != 1)) {
+		perror("usbtrace: fwrite, recording stopped");
+		fclose(trace_fp);
+		trace_fp = NULL;
+		return;
+	}
+	trace_records++;
+	if (is_out(kind))
+		trace_bytes_out += len;
+	else
+		trace_bytes_in += len;
+}
+
+/* Consume the next record, it must be a transfer of the same kind to
+ * the same value. IN transfers get the recorded data, OUT transfers
+ * are compared with it. Returns the recorded libusb result. */
+int usbtrace_replay(int kind, int value, void *data, int size)
+{
+	unsigned char rec[USBTRACE_REC_SIZE];
+	int rkind, rvalue, retval, len;
+
+	if (!trace_fp || usbtrace_mode != USBTRACE_REPLAY)
+		return -1;
+	if (fread(rec, USBTRACE_REC_SIZE, 1, trace_fp) != 1) {
+		printf("usbtrace: end of the trace after %lu records, "
+			"this session asks for more than the recorded one\n",
+			trace_records);
+		exit(1);
+	}
+	rkind = rec[0];
+	rvalue = get32(rec+4);
+	retval = get32(rec+8);
+	len = get32(rec+12);
+	trace_last = get64(rec+16);
+	if (rkind < USBTRACE_CTRL_OUT || rkind > USBTRACE_BULK_IN ||
+	    len > USBTRACE_PAYLOAD_MAX ||
+	    (len && fread(trace_payload, len, 1, trace_fp) != 1)) {
+		printf("usbtrace: corrupted trace at record %lu\n",
+			trace_records);
+		exit(1);
+	}
+	if (rkind != kind || rvalue != value ||
+	    (is_out(kind) && len != size)) {
+		printf("usbtrace: replay diverged at record %lu: "
+			"%s %X, %d bytes recorded, %s %X, %d bytes requested\n",
+			trace_records, kind_name[rkind], rvalue, len,
+			kind_name[kind], value, size);
+		exit(1);
+	}
+	trace_records++;
+	if (is_out(kind)) {
+		/* not fatal, the date sent by settime changes from run
+		 * to run, but a different file name would be reported
+		 * here too */
+		if (memcmp(data, trace_payload, len)) {
+			trace_mismatches++;
+			printf("usbtrace: record %lu, %s %X payload differs "
+				"from the recorded one\n",
+				trace_records-1, kind_name[kind], value);
+		}
+		trace_bytes_out += len;
+	} else {
+		memcpy(data, trace_payload, len > size ? size : len);
+		trace_bytes_in += len;
+	}
+	return retval;
+}
+
+void usbtrace_close(void)
+{
+	unsigned long long elapsed;
+
+	if (!trace_fp)
+		return;
+	elapsed = get_mono_usec() - trace_start;
+	if (usbtrace_mode == USBTRACE_RECORD) {
+		/* the model is known only now */
+		if (fseek(trace_fp, 5, SEEK_SET) == 0)
+			fputc(camera_model, trace_fp);
+		printf("usbtrace: %lu records, %llu bytes in, %llu bytes out "
+			"recorded in %llu ms\n", trace_records,
+			trace_bytes_in, trace_bytes_out, elapsed/1000);
+	} else {
+		printf("usbtrace: %lu records, %llu bytes in, %llu bytes out "
+			"replayed in %llu ms (recorded %llu ms), "
+			"%lu OUT payloads differ\n", trace_records,
+			trace_bytes_in, trace_bytes_out, elapsed/1000,
+			trace_last/1000, trace_mismatches);
+	}
+	fclose(trace_fp);
+	trace_fp = NULL;
+	usbtrace_mode = USBTRACE_OFF;
+}
@@ -0,0 +1,38 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_USBTRACE_H
+#define S10SH_USBTRACE_H
+
+/* trace modes */
+#define USBTRACE_OFF	0
+#define USBTRACE_RECORD	1	/* -r, log the session */
+#define USBTRACE_REPLAY	2	/* -R, the trace stands in for the camera */
+
+/* record kinds, the value is the endpoint or the control value */
+#define USBTRACE_CTRL_OUT	1
+#define USBTRACE_CTRL_IN	2
+#define USBTRACE_BULK_OUT	3
+#define USBTRACE_BULK_IN	4
+
+#define USBTRACE_MAGIC		"S10T"
+#define USBTRACE_VERSION	1
+#define USBTRACE_HDR_SIZE	16	/* magic, version, model, start time */
+#define USBTRACE_REC_SIZE	24	/* record header, the payload follows */
+#define USBTRACE_PAYLOAD_MAX	0x100000	/* the largest linkbench chunk */
+
+extern int usbtrace_mode;
+
+int usbtrace_record_open(char *filename);
+int usbtrace_replay_open(char *filename);
+void usbtrace_record(int kind, int value, int retval, void *data, int size);
+int usbtrace_replay(int kind, int value, void *data, int size);
+void usbtrace_close(void);
+
+#endif /* S10SH_USBTRACE_H */
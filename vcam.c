@@ -0,0 +1,714 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Virtual camera: an in-process PowerShot that answers the transfers
+ * of usb.c like the real USB camera does, backed by a generated card.
+ * Nothing of the card is stored but the attributes, the file data is
+ * computed from the file position on every read, so the card can be
+ * as large as needed. Latency, stalls, corrupted replies, files cut
+ * short and unplugs of the cable can be injected to test the host
+ * side. The remote capture adds the shots at the end of the last
+ * folder. The JPEGs start with an EXIF header: the model and the date
+ * of the listing.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include "s10sh.h"
+
+/* message layout, the same of usb.c */
+#define VC_HEADER	0x50	/* command header, the payload follows */
+#define VC_CMD1		0x44
+#define VC_CMD2		0x47
+#define VC_ANSWER	0x9c	/* USB_BUFFER_SIZE */
+#define VC_SIZE_HDR	0x40	/* the reply that holds the data size */
+
+#define VC_DATE_BASE	978307200	/* 2001-01-01 */
+#define VC_EXIF_LEN	128	/* SOI and the APP1 segment */
+
+/* card shape and faults, from the -V spec */
+static int vc_folders = 4;
+static int vc_files = 50;
+static unsigned int vc_size = 1000000;	/* average JPEG size */
+static int vc_crw = 0;			/* percent of CRW files */
+static int vc_new = 100;		/* percent of not downloaded files */
+static unsigned long vc_latency = 0;	/* usec per transfer */
+static unsigned long vc_stall_every = 0, vc_stall_ms = 0;
+static unsigned long vc_corrupt_every = 0;
+static unsigned long vc_short_every = 0;
+static unsigned long vc_unplug_every = 0, vc_unplug_ms = 0;
+static unsigned long long vc_unplugged = 0;	/* back at this usec */
+static unsigned long long vc_seed = 1;
+static unsigned long vc_capture_ms = 300;	/* busy after a release */
+
+static unsigned char *vc_attr;		/* per file attributes */
+static unsigned char *vc_gone;		/* deleted files and folders */
+static int vc_shots = 0;		/* captured, in the last folder */
+static unsigned long long vc_release = 0; /* usec of the pending shot */
+static char vc_owner[32] = "virtual";
+
+/* pending reply: a buffer, then generated file data */
+static unsigned char *reply = NULL;
+static int reply_len, reply_off, reply_alloc;
+static unsigned long long stream_key;
+static unsigned int stream_off, stream_left;
+static unsigned char stream_head[VC_EXIF_LEN];	/* over the first bytes */
+static unsigned int stream_head_len;
+
+static unsigned long long vc_rnd_state;
+static unsigned long vc_transfers, vc_stalls, vc_corrupted, vc_shorts;
+static unsigned long vc_unplugs;
+static unsigned long long vc_bytes, vc_card_bytes;
+
+#define FOLDER_GONE(f)	vc_gone[vc_folders*vc_files+VCAM_SHOTS_MAX+(f)]
+
+static unsigned long long splitmix(unsigned long long x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+static unsigned long vc_rnd(void)
+{
+	vc_rnd_state = splitmix(vc_rnd_state);
+	return vc_rnd_state >> 33;
+}
+
+static void put32(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+/* the shape of the file n of the folder f never changes */
+static unsigned long long file_key(int f, int n)
+{
+	return splitmix(vc_seed ^ ((unsigned long long)f << 32) ^ n);
+}
+
+/* the last folder grows with the shots */
+static int folder_files(int f)
+{
+	return f == vc_folders-1 ? vc_files+vc_shots : vc_files;
+}
+
+static int file_is_crw(int f, int n)
+{
+	return (int)(file_key(f, n) % 100) < vc_crw;
+}
+
+static unsigned int file_size(int f, int n)
+{
+	unsigned long long size = vc_size;
+
+	if (file_is_crw(f, n))
+		size *= 3;
+	/* +/- 25% */
+	return size * (75 + (file_key(f, n) >> 8) % 51) / 100;
+}
+
+static unsigned int file_date(int f, int n)
+{
+	return VC_DATE_BASE + (f*vc_files+n)*37;
+}
+
+/* the numbers go on from folder to folder, like on the real cards */
+static void file_name(int f, int n, char *name)
+{
+	int num = (f*vc_files + n) % VCAM_FILES_MAX + 1;
+
+	if (file_is_crw(f, n))
+		sprintf(name, "CRW_%04d.CRW", num);
+	else
+		sprintf(name, "IMG_%04d.JPG", num);
+}
+
+/* byte o of a file: JPEG markers at the start and at the end, and an
+ * embedded thumbnail from byte 16 to the middle */
+static void file_data(unsigned long long key, unsigned int total,
+	unsigned int off, unsigned char *buf, int len)
+{
+	unsigned long long word = 0;
+	unsigned int o;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		o = off + i;
+		if (i == 0 || (o & 7) == 0)
+			word = splitmix(key + (o >> 3));
+		buf[i] = word >> ((o & 7) * 8);
+		if (o == 0 || o == total-2 || o == 16 || o == total/2)
+			buf[i] = 0xFF;
+		else if (o == 1 || o == 17)
+			buf[i] = 0xD8;
+		else if (o == total-1 || o == total/2+1)
+			buf[i] = 0xD9;
+	}
+}
+
+static unsigned long parse_size(char *s)
+{
+	char *end;
+	unsigned long v = strtoul(s, &end, 10);
+
+	switch(*end) {
+	case 'k': case 'K': v *= 1024; break;
+	case 'm': case 'M': v *= 1024*1024; break;
+	case 'g': case 'G': v *= 1024*1024*1024; break;
+	}
+	return v;
+}
+
+static int parse_spec(char *spec)
+{
+	char buf[1024], *tok, *val;
+
+	strncpy(buf, spec, sizeof(buf)-1);
+	buf[sizeof(buf)-1] = '\0';
+	for (tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+		val = strchr(tok, '=');
+		if (!val) {
+			printf("vcam: '%s' should be key=value\n", tok);
+			return -1;
+		}
+		*val++ = '\0';
+		if (!strcmp(tok, "folders")) {
+			vc_folders = atoi(val);
+		} else if (!strcmp(tok, "files")) {
+			vc_files = atoi(val);
+		} else if (!strcmp(tok, "size")) {
+			vc_size = parse_size(val);
+		} else if (!strcmp(tok, "crw")) {
+			vc_crw = atoi(val);
+		} else if (!strcmp(tok, "new")) {
+			vc_new = atoi(val);
+		} else if (!strcmp(tok, "latency")) {
+			vc_latency = strtoul(val, NULL, 10);
+		} else if (!strcmp(tok, "stall")) {
+			vc_stall_every = strtoul(val, &val, 10);
+			vc_stall_ms = (*val == ':') ? strtoul(val+1, NULL, 10)
+						    : 1000;
+		} else if (!strcmp(tok, "corrupt")) {
+			vc_corrupt_every = strtoul(val, NULL, 10);
+		} else if (!strcmp(tok, "short")) {
+			vc_short_every = strtoul(val, NULL, 10);
+		} else if (!strcmp(tok, "unplug")) {
+			vc_unplug_every = strtoul(val, &val, 10);
+			vc_unplug_ms = (*val == ':') ? strtoul(val+1, NULL, 10)
+						     : 2000;
+		} else if (!strcmp(tok, "seed")) {
+			vc_seed = strtoull(val, NULL, 10);
+		} else if (!strcmp(tok, "capture")) {
+			vc_capture_ms = strtoul(val, NULL, 10);
+		} else {
+			printf("vcam: unknown spec key '%s'\n", tok);
+			return -1;
+		}
+	}
+	if (vc_folders < 0 || vc_folders > VCAM_FOLDERS_MAX ||
+	    vc_files < 0 || vc_files > VCAM_FILES_MAX ||
+	    vc_size < 16 || vc_crw < 0 || vc_crw > 100 ||
+	    vc_new < 0 || vc_new > 100) {
+		printf("vcam: at most %d folders of %d files, "
+			"size >= 16, crw and new 0-100%%\n",
+			VCAM_FOLDERS_MAX, VCAM_FILES_MAX);
+		return -1;
+	}
+	return 0;
+}
+
+int vcam_open(char *spec)
+{
+	int f, n;
+
+	if (spec && parse_spec(spec) == -1)
+		return -1;
+	vc_attr = malloc(vc_folders*vc_files+VCAM_SHOTS_MAX+1);
+	vc_gone = calloc(vc_folders*vc_files+VCAM_SHOTS_MAX+vc_folders+1, 1);
+	if (!vc_attr || !vc_gone) {
+		printf("vcam: out of memory\n");
+		exit(1);
+	}
+	vc_card_bytes = 0;
+	for (f = 0; f < vc_folders; f++) {
+		for (n = 0; n < vc_files; n++) {
+			vc_card_bytes += file_size(f, n);
+			vc_attr[f*vc_files+n] =
+				(int)((file_key(f, n) >> 16) % 100) < vc_new ?
+				ATTR_NEW : 0;
+		}
+	}
+	vc_rnd_state = vc_seed;
+	camera_model = S10;
+	printf("virtual camera: %d folders x %d files, %llu MB, %d%% CRW\n",
+		vc_folders, vc_files, vc_card_bytes >> 20, vc_crw);
+	return 0;
+}
+
+/* reply buffer helpers */
+static unsigned char *reply_new(int len)
+{
+	if (len > reply_alloc) {
+		reply = realloc(reply, len);
+		if (!reply) {
+			printf("vcam: out of memory\n");
+			exit(1);
+		}
+		reply_alloc = len;
+	}
+	memset(reply, 0, len);
+	reply_len = len;
+	reply_off = 0;
+	stream_left = 0;
+	return reply;
+}
+
+/* the data replies are a size header followed by the data */
+static unsigned char *reply_sized(int len)
+{
+	unsigned char *r = reply_new(VC_SIZE_HDR+len);
+
+	put32(r+6, len);
+	return r+VC_SIZE_HDR;
+}
+
+/* The path resolves to a level: 0 the root, 1 DCIM, 2 a folder,
+ * 3 a file. Returns -1 if it doesn't exist. */
+static int resolve(char *path, int *folder, int *file)
+{
+	char comp[64], name[16], *p, *q;
+	int level = 0, f, n;
+
+	if (strncasecmp(path, "D:", 2))
+		return -1;
+	for (p = path+2; *p; p = q) {
+		while(*p == '\\')
+			p++;
+		if (!*p)
+			break;
+		q = strchr(p, '\\');
+		if (!q)
+			q = p+strlen(p);
+		if (q-p >= (int)sizeof(comp))
+			return -1;
+		memcpy(comp, p, q-p);
+		comp[q-p] = '\0';
+		switch(level) {
+		case 0:
+			if (strcasecmp(comp, "DCIM"))
+				return -1;
+			break;
+		case 1:
+			f = atoi(comp) - 100;
+			if (strlen(comp) != 8 || strcasecmp(comp+3, "CANON") ||
+			    f < 0 || f >= vc_folders || FOLDER_GONE(f))
+				return -1;
+			*folder = f;
+			break;
+		case 2:
+			n = (atoi(comp+4) - 1 - (*folder*vc_files) %
+				VCAM_FILES_MAX + VCAM_FILES_MAX) % VCAM_FILES_MAX;
+			if (strlen(comp) != 12 || n < 0 ||
+			    n >= folder_files(*folder) ||
+			    vc_gone[*folder*vc_files+n])
+				return -1;
+			file_name(*folder, n, name);
+			if (strcasecmp(comp, name))
+				return -1;
+			*file = n;
+			break;
+		default:
+			return -1;
+		}
+		level++;
+	}
+	return level;
+}
+
+static unsigned char *list_entry(unsigned char *p, int attr,
+	unsigned int size, unsigned int date, char *name)
+{
+	p[0] = attr;
+	p[1] = 0;
+	put32(p+2, size);
+	put32(p+6, date);
+	strcpy((char*)p+10, name);
+	return p+10+strlen(name)+1;
+}
+
+static void reply_list(char *path)
+{
+	unsigned char *r, *p;
+	int level, f = 0, n = 0, entries;
+	char name[16];
+
+	level = resolve(path, &f, &n);
+	if (level == -1 || level == 3) {
+		reply_sized(0);
+		return;
+	}
+	entries = (level == 1) ? vc_folders :
+		  (level == 2) ? folder_files(f) : 1;
+	r = reply_sized(10 + strlen(path)+1 + entries*(10+16) + 11);
+	r[0] = 0x80;
+	strcpy((char*)r+10, path);
+	p = r+10+strlen(path)+1;
+	switch(level) {
+	case 0:
+		p = list_entry(p, ATTR_ITEMS, 0, VC_DATE_BASE, "DCIM");
+		break;
+	case 1:
+		for (f = 0; f < vc_folders; f++) {
+			if (FOLDER_GONE(f))
+				continue;
+			sprintf(name, "%03dCANON", f+100);
+			p = list_entry(p, ATTR_ITEMS, 0,
+				VC_DATE_BASE + f*vc_files*37, name);
+		}
+		break;
+	case 2:
+		for (n = 0; n < folder_files(f); n++) {
+			if (vc_gone[f*vc_files+n])
+				continue;
+			file_name(f, n, name);
+			p = list_entry(p, vc_attr[f*vc_files+n],
+				file_size(f, n), file_date(f, n), name);
+		}
+		break;
+	}
+	memset(p, 0, 11);
+	p += 11;
+	/* the real length, deleted entries are not there */
+	put32(reply+6, p-r);
+	reply_len = VC_SIZE_HDR + (p-r);
+}
+
+static void put16(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static unsigned char *ifd_entry(unsigned char *p, int tag, int type,
+	unsigned int count, unsigned int value)
+{
+	put16(p, tag);
+	put16(p+2, type);
+	put32(p+4, count);
+	put32(p+8, value);
+	return p+12;
+}
+
+/* SOI and an APP1 with a little endian TIFF: IFD0 with the Model and
+ * the Exif IFD, that one with DateTimeOriginal, the strings after. */
+static void exif_head(int f, int n)
+{
+	unsigned char *h = stream_head, *t = h+12, *p;
+	char model[] = "Canon PowerShot S10 virtual";
+	time_t date = file_date(f, n);
+
+	memset(h, 0, VC_EXIF_LEN);
+	h[0] = 0xFF; h[1] = 0xD8; h[2] = 0xFF; h[3] = 0xE1;
+	h[4] = (VC_EXIF_LEN-4) >> 8;
+	h[5] = (VC_EXIF_LEN-4) & 0xff;
+	memcpy(h+6, "Exif\0\0II*\0", 10);
+	put32(t+4, 8);
+	put16(t+8, 2);
+	p = ifd_entry(t+10, 0x0110, 2, sizeof(model), 68);
+	p = ifd_entry(p, 0x8769, 4, 1, 38);
+	put16(t+38, 1);
+	ifd_entry(t+40, 0x9003, 2, 20, 96);
+	memcpy(t+68, model, sizeof(model));
+	strftime((char*)t+96, 20, "%Y:%m:%d %H:%M:%S", gmtime(&date));
+	stream_head_len = VC_EXIF_LEN;
+}
+
+static void reply_data(char *path, int reqtype)
+{
+	int f = 0, n = 0;
+
+	if (resolve(path, &f, &n) != 3) {
+		reply_sized(0);
+		return;
+	}
+	reply_new(VC_SIZE_HDR);
+	stream_key = file_key(f, n) ^ reqtype;
+	stream_left = reqtype ? VCAM_THUMB_SIZE : file_size(f, n);
+	stream_off = 0;
+	stream_head_len = 0;
+	if (!reqtype && !file_is_crw(f, n) && stream_left > VC_EXIF_LEN*2)
+		exif_head(f, n);
+	put32(reply+6, stream_left);
+}
+
+/* status replies: the result byte follows the header */
+static void reply_status(int len, int status)
+{
+	reply_new(len)[VC_HEADER] = status;
+}
+
+/* The shot lands on the card a quarter of the busy time after the
+ * camera is ready again. */
+static void capture_done(void)
+{
+	int f = vc_folders-1, n;
+	unsigned long long now = get_mono_usec();
+
+	if (!vc_release || now < vc_release + vc_capture_ms*1250)
+		return;
+	vc_release = 0;
+	if (f < 0 || vc_shots == VCAM_SHOTS_MAX)
+		return;
+	n = vc_files + vc_shots++;
+	vc_attr[f*vc_files+n] = ATTR_NEW;
+	vc_card_bytes += file_size(f, n);
+}
+
+/* Remote control, the first payload byte is the operation. No reply
+ * to the exit while the camera is busy with a shot, the host times
+ * out like with the real one. */
+static void control(unsigned char *payload)
+{
+	switch(payload[0]) {
+	case 0x04: /* release shutter */
+		if (!vc_release)
+			vc_release = get_mono_usec();
+		break;
+	case 0x01: /* exit */
+		if (vc_release &&
+		    get_mono_usec() < vc_release + vc_capture_ms*1000) {
+			reply_new(0);
+			return;
+		}
+		break;
+	}
+	reply_new(VC_ANSWER);
+}
+
+static void command(unsigned char *msg, int size)
+{
+	unsigned char *payload = msg+VC_HEADER;
+	int cmd1 = msg[VC_CMD1], cmd2 = msg[VC_CMD2];
+	int level, f = 0, n = 0;
+	time_t now;
+
+	capture_done();
+	if (cmd2 == 0x12) {
+		switch(cmd1) {
+		case 0x13: /* remote control */
+			control(payload);
+			return;
+		case 0x01: /* identify */
+			reply_new(VC_ANSWER);
+			reply[0x58] = 0; reply[0x59] = 1;
+			reply[0x5a] = 0; reply[0x5b] = 1;
+			strcpy((char*)reply+0x5c, "Canon PowerShot S10");
+			strcpy((char*)reply+0x7c, vc_owner);
+			return;
+		case 0x05: /* set owner */
+			strncpy(vc_owner, (char*)payload, sizeof(vc_owner)-1);
+			reply_new(VC_ANSWER);
+			strcpy((char*)reply+0x5c, "Canon PowerShot S10");
+			return;
+		case 0x03: /* date */
+			reply_new(0x60);
+			now = time(NULL);
+			put32(reply+0x54, now);
+			return;
+		case 0x0a: /* power */
+			reply_new(0x58);
+			reply[0x54] = 0x06;
+			reply[0x57] = 0x10;
+			return;
+		}
+		reply_new(VC_ANSWER);
+		return;
+	}
+	switch(cmd1) {
+	case 0x0a: /* disk */
+		strcpy((char*)reply_sized(3), "D:");
+		return;
+	case 0x09: /* disk info, in bytes, the protocol has 32 bits */
+		reply_new(0x5c);
+		put32(reply+0x54, vc_card_bytes > 0x7fffffff ?
+			0x7fffffff : vc_card_bytes);
+		put32(reply+0x58, 0);
+		return;
+	case 0x0b: /* list */
+		reply_list((char*)payload+1);
+		return;
+	case 0x01: /* get data */
+		reply_data((char*)payload+8, payload[0]);
+		return;
+	case 0x0d: /* delete */
+		if (resolve((char*)payload, &f, &n) != 3 ||
+		    (vc_attr[f*vc_files+n] & ATTR_PROTECTED)) {
+			reply_status(0x54, 0x01);
+			return;
+		}
+		vc_gone[f*vc_files+n] = 1;
+		reply_status(0x54, 0x86);
+		return;
+	case 0x0e: /* set attributes */
+		if (resolve((char*)payload+4, &f, &n) != 3) {
+			reply_status(0x54, 0x01);
+			return;
+		}
+		vc_attr[f*vc_files+n] = payload[0];
+		reply_status(0x54, 0x86);
+		return;
+	case 0x05: /* mkdir, the shape of the card is fixed */
+		reply_status(0x54, 0x00);
+		return;
+	case 0x06: /* rmdir, only empty folders */
+		level = resolve((char*)payload, &f, &n);
+		if (level == 2) {
+			for (n = 0; n < folder_files(f); n++)
+				if (!vc_gone[f*vc_files+n])
+					break;
+			if (n == folder_files(f)) {
+				FOLDER_GONE(f) = 1;
+				reply_status(0x54, 0x00);
+				return;
+			}
+		}
+		reply_status(0x54, 0x01);
+		return;
+	}
+	reply_new(VC_ANSWER);
+}
+
+/* -1 and ENODEV while the camera is off the bus, like libusb 0.1 */
+static int faults(void)
+{
+	if (vc_unplugged) {
+		errno = ENODEV;
+		return -1;
+	}
+	vc_transfers++;
+	if (vc_latency)
+		usleep(vc_latency);
+	if (vc_stall_every && vc_rnd() % vc_stall_every == 0) {
+		vc_stalls++;
+		if (opt_debug)
+			printf("vcam: stall of %lu ms\n", vc_stall_ms);
+		usleep(vc_stall_ms*1000);
+	}
+	if (vc_unplug_every && vc_rnd() % vc_unplug_every == 0) {
+		vc_unplugs++;
+		if (opt_debug)
+			printf("vcam: unplugged for %lu ms\n", vc_unplug_ms);
+		vc_unplugged = get_mono_usec() + vc_unplug_ms*1000ULL;
+		errno = ENODEV;
+		return -1;
+	}
+	return 0;
+}
+
+/* is the camera on the bus? */
+int vcam_present(void)
+{
+	return !vc_unplugged || get_mono_usec() >= vc_unplugged;
+}
+
+/* plugged in again: nothing of the old session is left */
+void vcam_attach(void)
+{
+	vc_unplugged = 0;
+	reply_len = reply_off = 0;
+	stream_left = 0;
+}
+
+/* like usb_control_msg(), a char buffer */
+int vcam_control_msg(int in, int value, char *buffer, int size)
+{
+	if (faults() == -1)
+		return -1;
+	if (in) {
+		memset(buffer, 0, size);
+		if (value == 0x55)
+			buffer[0] = 'A'; /* already active */
+		return size;
+	}
+	if (value == 0x11) /* sync */
+		reply_new(0x44);
+	else if (value == 0x10 && size == VC_SIZE_HDR) /* upload block */
+		reply_new(VC_SIZE_HDR);
+	else if (value == 0x10 && size >= VC_HEADER)
+		command((unsigned char *)buffer, size);
+	return size;
+}
+
+int vcam_bulk_read(unsigned char *buffer, int size)
+{
+	int n;
+
+	if (faults() == -1)
+		return -1;
+	if (reply_off < reply_len) {
+		n = reply_len - reply_off;
+		if (n > size)
+			n = size;
+		memcpy(buffer, reply+reply_off, n);
+		reply_off += n;
+	} else if (stream_left) {
+		n = stream_left;
+		if (n > size)
+			n = size;
+		/* the file ends early, the rest is never sent */
+		if (vc_short_every && n > 1 &&
+		    vc_rnd() % vc_short_every == 0) {
+			vc_shorts++;
+			n /= 2;
+		}
+		file_data(stream_key, stream_off+stream_left, stream_off,
+			buffer, n);
+		if (stream_off < stream_head_len)
+			memcpy(buffer, stream_head+stream_off,
+				n < (int)(stream_head_len-stream_off) ?
+				n : stream_head_len-stream_off);
+		stream_off += n;
+		stream_left -= n;
+		if (n < size && stream_left)
+			stream_left = 0;
+	} else {
+		return -1; /* nothing to say, the real camera times out */
+	}
+	if (vc_corrupt_every && vc_rnd() % vc_corrupt_every == 0) {
+		vc_corrupted++;
+		buffer[vc_rnd() % n] ^= 1 << (vc_rnd() % 8);
+	}
+	vc_bytes += n;
+	return n;
+}
+
+/* uploaded data is accepted and dropped */
+int vcam_bulk_write(unsigned char *buffer, int size)
+{
+	if (faults() == -1)
+		return -1;
+	reply_new(0x5c);
+	return size;
+}
+
+void vcam_stats(void)
+{
+	printf("vcam: %lu transfers, %llu bytes read, %lu stalls, "
+		"%lu corrupted replies, %lu short files, %lu unplugs\n",
+		vc_transfers, vc_bytes, vc_stalls, vc_corrupted, vc_shorts,
+		vc_unplugs);
+}
@@ -0,0 +1,26 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_VCAM_H
+#define S10SH_VCAM_H
+
+#define VCAM_FOLDERS_MAX	900	/* 100CANON ... 999CANON */
+#define VCAM_FILES_MAX		9999	/* IMG_0001 ... IMG_9999 */
+#define VCAM_THUMB_SIZE		5000
+#define VCAM_SHOTS_MAX		100	/* remote captures */
+
+int vcam_open(char *spec);
+int vcam_control_msg(int in, int value, char *buffer, int size);
+int vcam_bulk_read(unsigned char *buffer, int size);
+int vcam_bulk_write(unsigned char *buffer, int size);
+int vcam_present(void);
+void vcam_attach(void);
+void vcam_stats(void);
+
+#endif /* S10SH_VCAM_H */
@@ -0,0 +1,705 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * Download output. By default a file is received in memory and written
+ * with one write() at the end. With -P pwrite or -P mmap the output
+ * file is opened before the transfer and its blocks are allocated at
+ * the size from the reply, then every chunk is written at its offset,
+ * or received straight into a shared mapping of the file: no copy of
+ * the whole file in memory and no fragmentation when many files grow
+ * at the same time. With pwrite the file size is always the bytes
+ * received, with mmap a failed transfer truncates it to them.
+ *
+ * The sinks get every chunk of the file from the same buffer, in order:
+ * a copy in more directories (-o, get and getall destinations), stdout
+ * or a FIFO. A stream that doesn't take the data is not waited for
+ * until its backlog is larger than sink_buffer (-b). A stream gets a
+ * file only once it passed the checks, held until then: a file fetched
+ * again is not sent twice. With -T the files
+ * go as members of a tar stream, in a file or on stdout, instead of on
+ * the disk: one sequential write for a whole card.
+ *
+ * The checks see the data once, in order, as it arrives: the count of
+ * bytes, the last two of them (the JPEG end marker) and, with -H, a
+ * SHA-256 for the manifest. With -N the start of the file goes to the
+ * EXIF parser. No second pass over the file.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* fallocate() */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "s10sh.h"
+
+int opt_output = OUT_WRITE;
+char *out_dir = NULL;		/* the files go there, NULL the current dir */
+int out_file = 1;		/* 0 if only the sinks get the files */
+unsigned int sink_buffer = SINK_BUFFER;
+
+static struct sink sinks[SINKS_MAX];
+static int nsinks = 0;
+static int stdout_fd = -1;	/* the real stdout once '-' is a sink */
+static int tar_session = 0;	/* -T, the files go only in the archive */
+
+static void sink_data(unsigned int off, unsigned char *data,
+	unsigned int len);
+
+void xfer_init(struct xfer *x, int mode, int fd)
+{
+	memset(x, 0, sizeof(*x));
+	x->mode = (fd == -1) ? OUT_WRITE : mode;
+	x->fd = fd;
+}
+
+/* Allocate the blocks of the whole file, the size doesn't change if
+ * keep. Only a hint, it may not be supported. */
+static void preallocate(int fd, unsigned int size, int keep)
+{
+#ifdef __linux__
+	if (fallocate(fd, keep ? FALLOC_FL_KEEP_SIZE : 0, 0, size) == 0)
+		return;
+#endif
+	if (!keep)
+		ftruncate(fd, size);
+}
+
+/* the size is known, get ready to receive */
+void xfer_begin(struct xfer *x, unsigned int size)
+{
+	x->size = size;
+	x->done = 0;
+	x->checked = 0;
+	if (x->hash)
+		sha256_init(&x->sha);
+	if (x->fanout)
+		sink_file_size(size);
+	switch(x->mode) {
+	case OUT_WRITE:
+		x->buf = malloc(size ? size : 1);
+		if (!x->buf) {
+			perror("malloc");
+			exit(1);
+		}
+		break;
+	case OUT_PWRITE:
+		preallocate(x->fd, size, 1);
+		break;
+	case OUT_MMAP:
+		preallocate(x->fd, size, 0);
+		if (size == 0)
+			break;
+		x->buf = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED,
+			x->fd, 0);
+		if (x->buf == MAP_FAILED) {
+			perror("mmap, using pwrite");
+			x->buf = NULL;
+			x->mode = OUT_PWRITE;
+		}
+		break;
+	}
+}
+
+/* where to receive len bytes at off */
+unsigned char *xfer_chunk(struct xfer *x, unsigned int off, unsigned int len)
+{
+	if (x->buf)
+		return x->buf+off;
+	if (len > x->stage_len) {
+		free(x->stage);
+		x->stage = malloc(len);
+		if (!x->stage) {
+			perror("malloc");
+			exit(1);
+		}
+		x->stage_len = len;
+	}
+	return x->stage;
+}
+
+/* The EXIF fields as soon as the start of the file has them, the
+ * first chunk most of the times. */
+static void xfer_exif(struct xfer *x, unsigned int off, unsigned char *data,
+	unsigned int len)
+{
+	if (off >= EXIF_HEAD)
+		return;
+	if (!x->head && !(x->head = malloc(EXIF_HEAD))) {
+		perror("malloc");
+		exit(1);
+	}
+	if (len > EXIF_HEAD - off)
+		len = EXIF_HEAD - off;
+	memcpy(x->head+off, data, len);
+	if (exif_parse(x->head, off+len, &x->info) == 0 ||
+	    off+len == EXIF_HEAD || off+len == x->size) {
+		x->exif = 0;
+		free(x->head);
+		x->head = NULL;
+	}
+}
+
+/* len bytes at off are in data, from xfer_chunk() or a packet */
+int xfer_put(struct xfer *x, unsigned int off, unsigned char *data,
+	unsigned int len)
+{
+	unsigned long long start;
+	unsigned int skip;
+
+	if (off > x->size || len > x->size - off) {
+		x->error = 1;
+		return -1;
+	}
+	if (x->buf) {
+		if (data != x->buf+off)
+			memcpy(x->buf+off, data, len);
+	} else {
+		start = get_mono_usec();
+		if (pwrite(x->fd, data, len, off) != (int)len) {
+			if (!x->error)
+				perror("pwrite");
+			x->error = 1;
+		}
+		x->wusec += get_mono_usec() - start;
+	}
+	if (x->fanout)
+		sink_data(off, data, len);
+	/* like the sinks, only what follows the data already seen */
+	if (off <= x->checked && off+len > x->checked) {
+		skip = x->checked - off;
+		if (x->hash)
+			sha256_update(&x->sha, data+skip, len-skip);
+		x->tail[0] = (len-skip >= 2) ? data[len-2] : x->tail[1];
+		x->tail[1] = data[len-1];
+		if (x->exif)
+			xfer_exif(x, off+skip, data+skip, len-skip);
+		x->checked = off+len;
+	}
+	if (off+len > x->done)
+		x->done = off+len;
+	/* the hooks and the -f time limit go on while the data arrives */
+	hook_check();
+	out_commit(0);
+	return x->error ? -1 : 0;
+}
+
+/* The transfer is over, ok if all of it arrived. A file is written or
+ * unmapped, the caller publishes or discards it. A memory transfer is
+ * only freed, on success the caller took buf. */
+int xfer_end(struct xfer *x, int ok)
+{
+	unsigned long long start = get_mono_usec();
+	int retval = x->error ? -1 : 0;
+
+	switch(x->mode) {
+	case OUT_WRITE:
+		if (x->fd != -1 && ok &&
+		    write(x->fd, x->buf, x->size) != (int)x->size) {
+			perror("write");
+			retval = -1;
+		}
+		if (x->fd != -1 || !ok)
+			free(x->buf);
+		break;
+	case OUT_PWRITE:
+		break;
+	case OUT_MMAP:
+		if (x->buf)
+			munmap(x->buf, x->size);
+		if (!ok && ftruncate(x->fd, x->done) == -1)
+			perror("ftruncate");
+		break;
+	}
+	x->buf = NULL;
+	free(x->stage);
+	x->stage = NULL;
+	free(x->head);
+	x->head = NULL;
+	if (x->fd != -1)
+		metrics_observe(MET_DISK_WRITE,
+			x->wusec + get_mono_usec() - start);
+	return ok ? retval : -1;
+}
+
+/* The data of a complete transfer against the listing size (0 if not
+ * known) and, for a JPEG, its end marker. With -H hex gets the hash. */
+int xfer_verify(struct xfer *x, char *name, unsigned int listed, char *hex)
+{
+	unsigned char digest[SHA256_LEN];
+	char *ext = strrchr(name, '.');
+	char *why = NULL;
+
+	if (x->checked != x->size)
+		why = "data missing";
+	else if (listed && x->size != listed)
+		why = "size is not the one of the listing";
+	else if (ext && !strcasecmp(ext, ".jpg") &&
+	    (x->size < 2 || x->tail[0] != 0xFF || x->tail[1] != 0xD9))
+		why = "no JPEG end marker";
+	if (why) {
+		printf("\n===WARNING===> %s: %s, %u of %u bytes, listed %u\n",
+			name, why, x->checked, x->size, listed);
+		metrics_count(MET_VERIFY_ERRORS, 1);
+		return -1;
+	}
+	if (x->hash) {
+		sha256_final(&x->sha, digest);
+		sha256_hex(digest, hex);
+	}
+	return 0;
+}
+
+int xfer_mode(char *name)
+{
+	if (!strcasecmp(name, "write"))
+		return OUT_WRITE;
+	else if (!strcasecmp(name, "pwrite"))
+		return OUT_PWRITE;
+	else if (!strcasecmp(name, "mmap"))
+		return OUT_MMAP;
+	return -1;
+}
+
+/* The messages go to stderr once stdout carries the data, the ones
+ * printed before too: they are flushed after the swap. */
+static int stdout_data(void)
+{
+	if (stdout_fd == -1) {
+		stdout_fd = dup(1);
+		dup2(2, 1);
+		fflush(stdout);
+	}
+	return stdout_fd;
+}
+
+static struct sink *sink_new(char *path, int type, int session, int fd)
+{
+	struct sink *s = &sinks[nsinks++];
+
+	memset(s, 0, sizeof(*s));
+	snprintf(s->path, sizeof(s->path), "%s", path);
+	s->type = type;
+	s->session = session;
+	s->fd = fd;
+	if (type != SINK_DIR) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		signal(SIGPIPE, SIG_IGN);
+	}
+	return s;
+}
+
+/* A destination: a directory, '-' for stdout or a FIFO, opened here
+ * (a FIFO waits for its reader). */
+int sink_open(char *path, int session)
+{
+	struct stat st;
+	int fd;
+
+	if (nsinks == SINKS_MAX) {
+		printf("at most %d destinations\n", SINKS_MAX);
+		return -1;
+	}
+	if (!strcmp(path, "-")) {
+		fd = stdout_data();
+	} else if (stat(path, &st) == -1) {
+		perror(path);
+		return -1;
+	} else if (S_ISDIR(st.st_mode)) {
+		fd = -1;
+	} else if (S_ISFIFO(st.st_mode)) {
+		fd = open(path, O_WRONLY);
+		if (fd == -1) {
+			perror(path);
+			return -1;
+		}
+	} else {
+		printf("%s is not a directory, - or a FIFO\n", path);
+		return -1;
+	}
+	sink_new(path, fd == -1 ? SINK_DIR : SINK_STREAM, session, fd);
+	return 0;
+}
+
+/* -T, a tar archive of all the downloads in a file or on stdout ('-') */
+int sink_tar_open(char *path)
+{
+	int fd;
+
+	if (nsinks == SINKS_MAX) {
+		printf("at most %d destinations\n", SINKS_MAX);
+		return -1;
+	}
+	if (!strcmp(path, "-")) {
+		fd = stdout_data();
+	} else {
+		fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (fd == -1) {
+			perror(path);
+			return -1;
+		}
+	}
+	sink_new(path, SINK_TAR, 1, fd);
+	tar_session = 1;
+	out_file = 0;
+	return 0;
+}
+
+/* The destinations of a get or getall: the first directory takes the
+ * file, the others get a copy. Without a directory there is no file,
+ * only the streams. */
+int sink_command(int argc, char **argv)
+{
+	struct stat st;
+	int j;
+
+	for (j = 0; j < argc; j++) {
+		if (!out_dir && stat(argv[j], &st) == 0 &&
+		    S_ISDIR(st.st_mode)) {
+			out_dir = argv[j];
+			continue;
+		}
+		if (sink_open(argv[j], 0) == -1) {
+			sink_release();
+			return -1;
+		}
+	}
+	if ((argc || tar_session) && !out_dir)
+		out_file = 0;
+	return 0;
+}
+
+static void sink_close(struct sink *s)
+{
+	if (s->type == SINK_DIR && s->fd != -1) {
+		out_discard(s->fd, s->tmp);
+	} else if (s->type != SINK_DIR && s->fd != stdout_fd) {
+		close(s->fd);
+	}
+	s->fd = -1;
+	free(s->backlog);
+	s->backlog = NULL;
+	s->blen = s->balloc = s->held = 0;
+}
+
+/* the end of a command, its destinations go away */
+void sink_release(void)
+{
+	int j, n = 0;
+
+	sink_flush();
+	for (j = 0; j < nsinks; j++) {
+		if (sinks[j].session)
+			sinks[n++] = sinks[j];
+		else
+			sink_close(&sinks[j]);
+	}
+	nsinks = n;
+	out_dir = NULL;
+	out_file = !tar_session;
+}
+
+/* name is the file in a directory, member in an archive */
+void sink_file_begin(char *name, char *member, time_t mtime)
+{
+	struct sink *s;
+	int j;
+
+	for (j = 0; j < nsinks; j++) {
+		s = &sinks[j];
+		s->off = 0;
+		if (s->type == SINK_TAR) {
+			snprintf(s->member, sizeof(s->member), "%s", member);
+			s->mtime = mtime;
+			s->header = 0;
+		}
+		if (s->type != SINK_DIR)
+			continue;
+		if (snprintf(s->file, sizeof(s->file), "%s/%s", s->path,
+		    name) >= (int)sizeof(s->file)) {
+			printf("%s/%s: name too long\n", s->path, name);
+			s->fd = -1;
+			continue;
+		}
+		s->fd = out_open(s->file, s->tmp);
+	}
+}
+
+static int stream_write(struct sink *s, unsigned char *data,
+	unsigned int len, int hold);
+static int stream_drain(struct sink *s, unsigned int limit);
+
+/* ustar header of the member, the size is the one of the reply */
+static int tar_header(struct sink *s, unsigned int size)
+{
+	unsigned char h[TAR_BLOCK];
+	unsigned int sum = 0;
+	int j;
+
+	memset(h, 0, sizeof(h));
+	memcpy(h, s->member, strlen(s->member));
+	sprintf((char*)h+100, "%07o", 0644);
+	sprintf((char*)h+108, "%07o", 0);
+	sprintf((char*)h+116, "%07o", 0);
+	sprintf((char*)h+124, "%011o", size);
+	sprintf((char*)h+136, "%011lo", (unsigned long)s->mtime);
+	h[156] = '0';
+	memcpy(h+257, "ustar", 6);
+	memcpy(h+263, "00", 2);
+	memset(h+148, ' ', 8);
+	for (j = 0; j < TAR_BLOCK; j++)
+		sum += h[j];
+	sprintf((char*)h+148, "%06o", sum);
+	h[155] = ' ';
+	s->size = size;
+	s->header = 1;
+	return stream_write(s, h, TAR_BLOCK, 0);
+}
+
+/* the data of the member follows its header */
+void sink_file_size(unsigned int size)
+{
+	int j;
+
+	for (j = 0; j < nsinks; j++) {
+		if (sinks[j].type == SINK_TAR && sinks[j].fd != -1 &&
+		    !sinks[j].header && tar_header(&sinks[j], size) == -1) {
+			perror(sinks[j].path);
+			sink_close(&sinks[j]);
+		}
+	}
+}
+
+/* The member is padded to the block, and to its size if the transfer
+ * failed: the archive stays readable. */
+static int tar_end(struct sink *s)
+{
+	static unsigned char zero[TAR_BLOCK];
+	unsigned int n;
+
+	if (!s->header)
+		return 0;
+	if (s->off < s->size)
+		printf("%s: %s is short, filled with zeros\n", s->path,
+			s->member);
+	while(s->off < s->size) {
+		n = s->size - s->off;
+		if (n > TAR_BLOCK)
+			n = TAR_BLOCK;
+		if (stream_write(s, zero, n, 0) == -1)
+			return -1;
+		s->off += n;
+	}
+	n = (TAR_BLOCK - s->size % TAR_BLOCK) % TAR_BLOCK;
+	s->header = 0;
+	return n ? stream_write(s, zero, n, 0) : 0;
+}
+
+/* The copies are published with the date of the file, or removed.
+ * name is the one from -N, under the directory of the copy. */
+void sink_file_end(int ok, time_t mtime, char *name)
+{
+	struct sink *s;
+	int j;
+
+	for (j = 0; j < nsinks; j++) {
+		s = &sinks[j];
+		if (s->type == SINK_TAR && s->fd != -1 && tar_end(s) == -1) {
+			perror(s->path);
+			sink_close(s);
+		}
+		/* a stream gets the file now, or never */
+		if (s->type == SINK_STREAM && s->fd != -1) {
+			if (!ok)
+				s->blen -= s->held;
+			s->held = 0;
+			if (stream_drain(s, sink_buffer) == -1) {
+				perror(s->path);
+				sink_close(s);
+			}
+		}
+		if (s->type != SINK_DIR || s->fd == -1)
+			continue;
+		if (!ok) {
+			sink_close(s);
+			continue;
+		}
+		if (name && name[0] != '/') {
+			if (snprintf(s->file, sizeof(s->file), "%s/%s",
+			    s->path, name) >= (int)sizeof(s->file)) {
+				printf("%s/%s: name too long\n", s->path,
+					name);
+				sink_close(s);
+				continue;
+			}
+			if (out_mkdirs(s->file) == -1) {
+				sink_close(s);
+				continue;
+			}
+		}
+		out_publish(s->fd, s->tmp, s->file, mtime);
+		s->fd = -1;
+	}
+}
+
+/* Write what the stream takes without waiting, up to the backlog
+ * limit. Returns -1 if the reader went away. The held file stays. */
+static int stream_drain(struct sink *s, unsigned int limit)
+{
+	struct pollfd pfd;
+	int n;
+
+	while(s->blen - s->held > limit) {
+		n = write(s->fd, s->backlog, s->blen - s->held);
+		if (n > 0) {
+			memmove(s->backlog, s->backlog+n, s->blen-n);
+			s->blen -= n;
+			continue;
+		}
+		if (n == -1 && errno != EAGAIN && errno != EINTR)
+			return -1;
+		pfd.fd = s->fd;
+		pfd.events = POLLOUT;
+		poll(&pfd, 1, -1);
+	}
+	return 0;
+}
+
+/* at the end of the backlog, with hold until sink_file_end() */
+static int stream_write(struct sink *s, unsigned char *data, unsigned int len,
+	int hold)
+{
+	int n = 0;
+
+	/* try to push the old data, then the new one if nothing waits */
+	while(s->blen - s->held) {
+		n = write(s->fd, s->backlog, s->blen - s->held);
+		if (n <= 0)
+			break;
+		memmove(s->backlog, s->backlog+n, s->blen-n);
+		s->blen -= n;
+	}
+	if (n == -1 && errno != EAGAIN && errno != EINTR)
+		return -1;
+	if (s->blen == 0 && !hold) {
+		n = write(s->fd, data, len);
+		if (n == -1 && errno != EAGAIN && errno != EINTR)
+			return -1;
+		if (n > 0) {
+			data += n;
+			len -= n;
+		}
+	}
+	if (len == 0)
+		return 0;
+	if (s->blen + len > s->balloc) {
+		unsigned char *newmem;
+
+		/* a held file grows a chunk at a time */
+		n = s->blen + len > s->balloc*2 ? s->blen + len : s->balloc*2;
+		newmem = realloc(s->backlog, n);
+		if (!newmem) {
+			perror("realloc");
+			exit(1);
+		}
+		s->backlog = newmem;
+		s->balloc = n;
+	}
+	memcpy(s->backlog+s->blen, data, len);
+	s->blen += len;
+	if (hold)
+		s->held += len;
+	return stream_drain(s, sink_buffer);
+}
+
+/* Only what follows the bytes already out: a serial retransmission
+ * resends the data of the whole sequence. */
+static void sink_data(unsigned int off, unsigned char *data, unsigned int len)
+{
+	struct sink *s;
+	unsigned int skip, n;
+	int j, retval;
+
+	for (j = 0; j < nsinks; j++) {
+		s = &sinks[j];
+		if (s->fd == -1 || off > s->off || off+len <= s->off)
+			continue;
+		if (s->type == SINK_TAR && !s->header)
+			continue;
+		/* a tar member gets no more than its size, the others all */
+		n = len;
+		if (s->type == SINK_TAR && off+n > s->size)
+			n = s->size > off ? s->size - off : 0;
+		if (off+n <= s->off)
+			continue;
+		skip = s->off - off;
+		if (s->type == SINK_DIR)
+			retval = write(s->fd, data+skip, n-skip) ==
+				(int)(n-skip) ? 0 : -1;
+		else
+			retval = stream_write(s, data+skip, n-skip,
+				s->type == SINK_STREAM);
+		if (retval == -1) {
+			perror(s->path);
+			sink_close(s);
+			continue;
+		}
+		s->off += n-skip;
+	}
+}
+
+/* all the backlogs out, at the end of a command and at exit */
+void sink_flush(void)
+{
+	int j;
+
+	for (j = 0; j < nsinks; j++) {
+		if (sinks[j].type != SINK_DIR && sinks[j].fd != -1 &&
+		    stream_drain(&sinks[j], 0) == -1) {
+			perror(sinks[j].path);
+			sink_close(&sinks[j]);
+		}
+	}
+}
+
+/* at exit, the end of the archives and all the backlogs out */
+void sink_finish(void)
+{
+	static unsigned char zero[2*TAR_BLOCK];
+	int j;
+
+	for (j = 0; j < nsinks; j++)
+		if (sinks[j].type == SINK_TAR && sinks[j].fd != -1 &&
+		    stream_write(&sinks[j], zero, sizeof(zero), 0) == -1) {
+			perror(sinks[j].path);
+			sink_close(&sinks[j]);
+		}
+	sink_flush();
+}
+
+/* -b, bytes with a k or M suffix */
+unsigned int sink_size(char *s)
+{
+	char *end;
+	unsigned long v = strtoul(s, &end, 10);
+
+	if (*end == 'k' || *end == 'K')
+		v *= 1024;
+	else if (*end == 'm' || *end == 'M')
+		v *= 1024*1024;
+	return v;
+}
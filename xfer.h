@@ -0,0 +1,93 @@
+/* This file is part of s10sh
+ *
+ * S10sh IS FREE SOFTWARE, UNDER THE TERMS OF THE GPL VERSION 2
+ * don't forget what free software means, even if today is so diffused.
+ *
+ * ALL THIRD PARTY BRAND, PRODUCT AND SERVICE NAMES MENTIONED ARE
+ * THE TRADEMARK OR REGISTERED TRADEMARK OF THEIR RESPECTIVE OWNERS
+ */
+
+#ifndef S10SH_XFER_H
+#define S10SH_XFER_H
+
+/* output modes of the downloads, -P */
+#define OUT_WRITE	0	/* the file in memory, one write() at the end */
+#define OUT_PWRITE	1	/* preallocated, a pwrite() per chunk */
+#define OUT_MMAP	2	/* preallocated, received into a mapping */
+
+/* A download in progress: the data goes to memory, or to fd when it
+ * is set. buf is where the data is received when there is one. */
+struct xfer {
+	int mode;
+	int fd;
+	unsigned char *buf;
+	unsigned char *stage;		/* a chunk, OUT_PWRITE */
+	unsigned int stage_len;
+	unsigned int size;		/* from the reply */
+	unsigned int done;		/* bytes stored, the highest offset */
+	unsigned long long wusec;	/* time spent writing */
+	int error;
+	int fanout;			/* the sinks get the data too */
+	int hash;			/* a SHA-256 of the data, -H */
+	unsigned int checked;		/* bytes seen in order by the checks */
+	unsigned char tail[2];		/* the last two of them */
+	struct sha256 sha;
+	int exif;			/* -N, look for the EXIF fields */
+	unsigned char *head;		/* the first EXIF_HEAD bytes */
+	struct exif info;
+};
+
+/* a file that fails the checks is fetched again this many times */
+#define VERIFY_RETRIES	2
+
+/* more destinations of the downloads, -o and get <path> <dest>... */
+#define SINKS_MAX	8
+#define SINK_DIR	0	/* a copy of every file in a directory */
+#define SINK_STREAM	1	/* stdout or a FIFO, the files one after another */
+#define SINK_TAR	2	/* a tar archive of the files, -T */
+#define TAR_BLOCK	512
+#define SINK_BUFFER	(8*1024*1024)	/* backlog of a slow stream, -b */
+
+struct sink {
+	char path[1024];
+	int type;
+	int session;			/* from -o, not only this command */
+	int fd;
+	char file[1024];		/* SINK_DIR, the copy being written */
+	char tmp[1024];			/* and its temporary name */
+	unsigned int off;		/* bytes of the file out */
+	unsigned int size;		/* SINK_TAR, of the member */
+	char member[100];		/* SINK_TAR, its name */
+	time_t mtime;
+	int header;			/* the member header is out */
+	unsigned char *backlog;		/* SINK_STREAM, not taken yet */
+	unsigned int blen, balloc;
+	unsigned int held;		/* at its end, the file not checked */
+};
+
+extern int opt_output;
+extern char *out_dir;
+extern int out_file;
+extern unsigned int sink_buffer;
+
+void xfer_init(struct xfer *x, int mode, int fd);
+void xfer_begin(struct xfer *x, unsigned int size);
+unsigned char *xfer_chunk(struct xfer *x, unsigned int off, unsigned int len);
+int xfer_put(struct xfer *x, unsigned int off, unsigned char *data,
+	unsigned int len);
+int xfer_end(struct xfer *x, int ok);
+int xfer_mode(char *name);
+int xfer_verify(struct xfer *x, char *name, unsigned int listed,
+	char *hex);
+int sink_open(char *path, int session);
+int sink_tar_open(char *path);
+int sink_command(int argc, char **argv);
+void sink_release(void);
+void sink_file_begin(char *name, char *member, time_t mtime);
+void sink_file_size(unsigned int size);
+void sink_file_end(int ok, time_t mtime, char *name);
+void sink_flush(void);
+void sink_finish(void);
+unsigned int sink_size(char *s);
+
+#endif /* S10SH_XFER_H */